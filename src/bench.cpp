@@ -0,0 +1,228 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+// Benchmark of each stage of the generation, results are printed as a table and saved in json.
+
+#include <geometry.hpp>
+#include <packed.hpp>
+#include <penrose.hpp>
+#include <rng.hpp>
+#include <save.hpp>
+#include <stats.hpp>
+#include <wallpaper.hpp>
+
+#include <cxxopts.hpp>
+#include <spdlog/cfg/env.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+// Allocation counting
+
+namespace {
+std::atomic<size_t> allocationCount = 0;
+std::atomic<size_t> allocationBytes = 0;
+
+void countAllocation(size_t size) {
+  ++allocationCount;
+  allocationBytes += size;
+}
+} // namespace
+
+STATS_REPLACE_OPERATOR_NEW(countAllocation)
+
+namespace {
+
+using namespace penrose;
+
+constexpr Canvas canvas = {2000, 2000};
+
+struct Result {
+  std::string stage;
+  std::string form;
+  int level;
+  size_t tiles;
+  size_t bytes;
+  double milliseconds;
+  size_t allocations;
+  size_t allocatedBytes;
+};
+
+// Run function repeat times and keep the fastest run, allocations are the ones of the last run.
+// function return the number of tiles and bytes it produced.
+template <typename Function>
+Result measure(const std::string &stage, const std::string &form, int level, int repeat, Function &&function) {
+  Result result = {stage, form, level, 0, 0, std::numeric_limits<double>::max(), 0, 0};
+  for (int run = 0; run < repeat; ++run) {
+    const size_t count = allocationCount;
+    const size_t bytes = allocationBytes;
+    const auto start = std::chrono::high_resolution_clock::now();
+    const auto [tiles, outputBytes] = function();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    result.milliseconds = std::min(result.milliseconds, elapsed.count());
+    result.tiles = tiles;
+    result.bytes = outputBytes;
+    result.allocations = allocationCount - count;
+    result.allocatedBytes = allocationBytes - bytes;
+  }
+  fmt::print("{:<16} {} {:>3} {:>10} tiles {:>10.2f} ms {:>8.2f} Mtiles/s {:>8.1f} MB/s {:>8} allocations\n",
+             result.stage, result.form, result.level, result.tiles, result.milliseconds,
+             result.tiles / result.milliseconds / 1e3, result.bytes / result.milliseconds / 1e3, result.allocations);
+  return result;
+}
+
+template <size_t N>
+size_t bytesOf(const std::array<PolygonArray<N>, 4> &buckets) {
+  return total(countKinds(buckets)) * (2 * N * sizeof(float) + 1);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) try {
+
+  spdlog::cfg::load_env_levels();
+
+  // =================================================================================================
+  // CLI
+  cxxopts::Options options(argv[0], "Benchmark of the generation stages");
+
+  // clang-format off
+  options.add_options()
+    ("h,help", "Print help")
+    ("min-level", "First level benchmarked", cxxopts::value<int>()->default_value("6"))
+    ("max-level", "Last level benchmarked", cxxopts::value<int>()->default_value("14"))
+    ("repeat", "Number of runs of each stage, the fastest is kept", cxxopts::value<int>()->default_value("3"))
+    ("o,output", "Json output filename", cxxopts::value<std::string>()->default_value("bench.json"))
+    ;
+  // clang-format on
+  auto clo = options.parse(argc, argv);
+
+  if (clo.count("help")) {
+    fmt::print("{}", options.help());
+    return EXIT_SUCCESS;
+  }
+
+  const int minLevel = clo["min-level"].as<int>();
+  const int maxLevel = clo["max-level"].as<int>();
+  const int repeat = std::max(1, clo["repeat"].as<int>());
+  const std::string filename = clo["output"].as<std::string>();
+
+  // =================================================================================================
+  // Code
+
+  const Rectangle viewport = penrose::viewport(canvas);
+  std::vector<Result> results;
+
+  for (const bool rhombus : {false, true}) {
+    const std::string form = rhombus ? "P3" : "P2";
+    const TriangleSoA seed = toSoA(initialPatch(rhombus, canvas));
+
+    for (int level = std::max(minLevel, 1); level <= maxLevel; ++level) {
+      // each stage works on the output of the previous one, like deflateAndMerge
+      TriangleSoA triangles;
+      results.push_back(measure("deflate", form, level, repeat, [&] {
+        triangles = deflate(seed, level, viewport);
+        return std::pair(total(countKinds(triangles)), bytesOf(triangles));
+      }));
+
+      QuadrilateralSoA completed;
+      results.push_back(measure("completeShape", form, level, repeat, [&] {
+        completed = completeShape(triangles);
+        return std::pair(total(countKinds(completed)), bytesOf(completed));
+      }));
+
+      std::vector<PenroseQuadrilateral> quadrilaterals;
+      results.push_back(measure("removeDuplicates", form, level, repeat, [&] {
+        quadrilaterals = toQuadrilaterals(completed);
+        removeDuplicates(quadrilaterals);
+        return std::pair(quadrilaterals.size(), quadrilaterals.size() * sizeof(PenroseQuadrilateral));
+      }));
+
+      results.push_back(measure("splitShape", form, level, repeat, [&] {
+        const std::vector<PenroseTriangle> split = splitShape(quadrilaterals);
+        return std::pair(quadrilaterals.size(), split.size() * sizeof(PenroseTriangle));
+      }));
+
+      const float margin = norm(quadrilaterals[0].vertices[0] - quadrilaterals[0].vertices[1]) / 15.f;
+      results.push_back(measure("addMargin", form, level, repeat, [&] {
+        const std::vector<PenroseQuadrilateral> margined = addMargin(quadrilaterals, margin);
+        return std::pair(margined.size(), margined.size() * sizeof(PenroseQuadrilateral));
+      }));
+
+      results.push_back(measure("setRandomFlag", form, level, repeat, [&] {
+        setRandomFlag(quadrilaterals, rng::Generator(level, 0), 5);
+        return std::pair(quadrilaterals.size(), quadrilaterals.size());
+      }));
+
+      results.push_back(measure("svg", form, level, repeat, [&] {
+        // same layers as the default output of the application
+        const svg::Style style1 = {{{140, 140, 140}}, {}};
+        const svg::Style style2 = {{{70, 70, 70}}, {}};
+        const svg::Style style3 = {{}, {{{0, 0, 0}, margin / 2.f}}};
+        svg::Document doc(canvas.width, background);
+        doc.addPolygons(quadrilaterals, {style1, style2, style3}, [](const auto &tr, size_t) {
+          return (tr.flag ? 1u << (isSmall(tr.color) ? 1 : 0) : 0u) | (1u << 2);
+        });
+        const std::string content = doc.getContent();
+        return std::pair(quadrilaterals.size(), content.size());
+      }));
+
+      // deflate to merged tiles from the seed with packed triangles, compare to deflate + completeShape + removeDuplicates
+      const PackedTiling packedSeed = pack(initialPatch(rhombus, canvas));
+      results.push_back(measure("packedDeflate", form, level, repeat, [&] {
+        const PackedTiling packed = deflateAndMerge(packedSeed, level, 1, viewport);
+        return std::pair(packed.triangles.size(), packed.triangles.size() * sizeof(PackedTriangle));
+      }));
+
+      // deflate whole tiles from the initial patch, each tile is produced once so there is no duplicate to remove
+      const std::vector<PenroseTriangle> patch = initialPatch(rhombus, canvas);
+      results.push_back(measure("wholeTiles", form, level, repeat, [&] {
+        const std::vector<PenroseQuadrilateral> tiles = deflateTiles(patch, level, 1, viewport);
+        return std::pair(tiles.size(), tiles.size() * sizeof(PenroseQuadrilateral));
+      }));
+    }
+  }
+
+  std::FILE *file = std::fopen(filename.c_str(), "w");
+  if (!file) {
+    spdlog::error("Cannot open output file : {}.", filename);
+    return EXIT_FAILURE;
+  }
+  fmt::print(file, "[\n");
+  for (size_t idx = 0; idx < results.size(); ++idx) {
+    const Result &result = results[idx];
+    fmt::print(file, "  {{\"stage\": \"{}\", \"form\": \"{}\", \"level\": {}, \"tiles\": {}, \"bytes\": {}, \"milliseconds\": {:.4f}, "
+                     "\"tilesPerSecond\": {:.0f}, \"bytesPerSecond\": {:.0f}, \"allocations\": {}, \"allocatedBytes\": {}}}{}\n",
+               result.stage, result.form, result.level, result.tiles, result.bytes, result.milliseconds,
+               result.tiles / result.milliseconds * 1e3, result.bytes / result.milliseconds * 1e3,
+               result.allocations, result.allocatedBytes, idx + 1 < results.size() ? "," : "");
+  }
+  fmt::print(file, "]\n");
+  std::fclose(file);
+
+  return EXIT_SUCCESS;
+
+} catch (const cxxopts::OptionException &e) {
+  spdlog::error("Parsing options : {}", e.what());
+  return EXIT_FAILURE;
+
+} catch (const std::exception &e) {
+  spdlog::error("{}", e.what());
+  return EXIT_FAILURE;
+}
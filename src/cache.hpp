@@ -0,0 +1,422 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <packed.hpp>
+#include <penrose.hpp>
+#include <stats.hpp>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cache {
+
+using penrose::PackedTriangle;
+using penrose::PenroseQuadrilateral;
+
+// Tiles are stored with their in-memory layout so a mapped file is used without parsing, as completed
+// quadrilaterals or as packed triangles. The version must be increased each time PenroseQuadrilateral,
+// PackedTriangle or the header change.
+constexpr uint32_t version = 3;
+constexpr char magic[8] = {'P', 'E', 'N', 'R', 'O', 'S', 'E', '\0'};
+constexpr size_t sectionAlignment = 64;
+
+static_assert(std::is_trivially_copyable_v<PenroseQuadrilateral>, "tiles are stored as raw bytes");
+static_assert(std::is_trivially_copyable_v<PackedTriangle>, "tiles are stored as raw bytes");
+static_assert(sizeof(PackedTriangle) != sizeof(PenroseQuadrilateral), "the record size tells packed files apart");
+
+// Parameters that fully define a tiling
+struct Key {
+  bool rhombus;
+  bool exact;
+  bool packed;
+  bool wholeTiles;
+  int level;
+  int step;
+  int canvasWidth;
+  int canvasHeight;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  int32_t level;
+  int32_t step;
+  int32_t canvasWidth;
+  int32_t canvasHeight;
+  uint8_t rhombus;
+  uint8_t exact;
+  uint8_t packed;
+  uint8_t wholeTiles;
+  uint8_t padding[4];
+  // frame and levels of packed tiles, 0 for quadrilaterals
+  float frameRotation;
+  float frameScale;
+  int32_t tilesLevel;
+  int32_t coarseLevel;
+  uint64_t tileCount;
+  uint64_t coarseCount;
+  uint64_t tilesOffset;
+  uint64_t coarseOffset;
+  uint64_t parentOffset;
+  uint64_t fileSize;
+  // payloadChecksum of the tiles, coarse tiles and parents sections
+  uint64_t payloadChecksum;
+  // FNV-1a of the header with this field set to 0
+  uint64_t checksum;
+};
+
+constexpr uint64_t fnvOffset = 0xcbf29ce484222325ull;
+constexpr uint64_t fnvPrime = 0x100000001b3ull;
+
+inline uint64_t checksum(Header header) {
+  header.checksum = 0;
+  const auto *bytes = reinterpret_cast<const uint8_t *>(&header);
+  uint64_t hash = fnvOffset;
+  for (size_t idx = 0; idx < sizeof(Header); ++idx) {
+    hash = (hash ^ bytes[idx]) * fnvPrime;
+  }
+  return hash;
+}
+
+// FNV-1a on 8 bytes words continuing hash, sections are hashed one after the other.
+// Words keep the check of a large tiling much faster than the file read.
+inline uint64_t payloadChecksum(uint64_t hash, const void *data, size_t size) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  size_t idx = 0;
+  for (; idx + sizeof(uint64_t) <= size; idx += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + idx, sizeof(word));
+    hash = (hash ^ word) * fnvPrime;
+  }
+  for (; idx < size; ++idx) {
+    hash = (hash ^ bytes[idx]) * fnvPrime;
+  }
+  return hash;
+}
+
+inline bool isValid(const PenroseQuadrilateral &tile) {
+  return static_cast<unsigned>(tile.color) <= static_cast<unsigned>(penrose::TriangleKind::kRhombsViolet);
+}
+
+// kind and orientation index the shapes of a PackedLevel
+inline bool isValid(const PackedTriangle &tile) {
+  return tile.kind <= static_cast<uint8_t>(penrose::TriangleKind::kRhombsViolet) && tile.orientation < penrose::orientationCount;
+}
+
+// Tiles with a valid kind and parents pointing to a coarse tile, a corrupted file that still
+// matches its checksums must not lead to out of bounds accesses
+template <typename Record>
+bool isConsistent(std::span<const Record> tiles, std::span<const Record> coarse, std::span<const uint32_t> parent) {
+  auto validKind = [](const Record &tile) {
+    return isValid(tile);
+  };
+  return std::all_of(tiles.begin(), tiles.end(), validKind) &&
+         std::all_of(coarse.begin(), coarse.end(), validKind) &&
+         std::all_of(parent.begin(), parent.end(), [&](uint32_t idx) { return idx < coarse.size(); });
+}
+
+inline std::string filename(const Key &key) {
+  return fmt::format("penrose-{}{}{}{}-l{}-s{}-c{}x{}.bin", key.rhombus ? "p3" : "p2", key.exact ? "-exact" : "", key.packed ? "-packed" : "", key.wholeTiles ? "-tiles" : "", key.level, key.step, key.canvasWidth, key.canvasHeight);
+}
+
+// Read only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::filesystem::path &path) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+      HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping) {
+        address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = address ? static_cast<size_t>(fileSize.QuadPart) : 0;
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+      if (mapped != MAP_FAILED) {
+        address = mapped;
+        size = static_cast<size_t>(info.st_size);
+      }
+    }
+    ::close(fd);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : address(std::exchange(other.address, nullptr)), size(std::exchange(other.size, 0)) {
+  }
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    std::swap(address, other.address);
+    std::swap(size, other.size);
+    return *this;
+  }
+
+  ~MappedFile() {
+    if (!address) {
+      return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(address);
+#else
+    ::munmap(address, size);
+#endif
+  }
+
+  const uint8_t *data() const {
+    return static_cast<const uint8_t *>(address);
+  }
+
+  size_t bytes() const {
+    return size;
+  }
+
+private:
+  void *address = nullptr;
+  size_t size = 0;
+};
+
+// Frame and levels the vertices of packed tiles are rebuilt from
+struct PackedLevels {
+  penrose::PackedFrame frame;
+  int tiles;
+  int coarse;
+};
+
+// Tiling mapped from a cache file, the spans point into the mapping
+template <typename Record>
+struct Tiling {
+  std::span<const Record> tiles;
+  std::span<const Record> coarse;
+  std::span<const uint32_t> parent;
+  PackedLevels levels;
+  MappedFile file;
+};
+
+// Map the cached tiling of key stored as Record, nothing is returned when the file is missing or does not match
+template <typename Record = PenroseQuadrilateral>
+std::optional<Tiling<Record>> load(const std::filesystem::path &directory, const Key &key) {
+  const std::filesystem::path path = directory / filename(key);
+  MappedFile file(path);
+  if (file.bytes() < sizeof(Header)) {
+    return {};
+  }
+  Header header;
+  std::memcpy(&header, file.data(), sizeof(Header));
+  const bool valid = std::memcmp(header.magic, magic, sizeof(magic)) == 0 &&
+                     header.checksum == checksum(header) &&
+                     header.version == version &&
+                     header.recordSize == sizeof(Record) &&
+                     header.level == key.level && header.step == key.step && header.canvasWidth == key.canvasWidth && header.canvasHeight == key.canvasHeight &&
+                     header.rhombus == key.rhombus && header.exact == key.exact && header.packed == key.packed && header.wholeTiles == key.wholeTiles &&
+                     header.fileSize == file.bytes() &&
+                     header.tilesOffset + header.tileCount * sizeof(Record) <= header.fileSize &&
+                     header.coarseOffset + header.coarseCount * sizeof(Record) <= header.fileSize &&
+                     header.parentOffset + (header.coarseCount ? header.tileCount : 0) * sizeof(uint32_t) <= header.fileSize;
+  if (!valid) {
+    spdlog::warn("Ignoring invalid cache file : {}.", path.string());
+    return {};
+  }
+
+  Tiling<Record> tiling;
+  tiling.tiles = {reinterpret_cast<const Record *>(file.data() + header.tilesOffset), header.tileCount};
+  tiling.coarse = {reinterpret_cast<const Record *>(file.data() + header.coarseOffset), header.coarseCount};
+  tiling.parent = {reinterpret_cast<const uint32_t *>(file.data() + header.parentOffset), header.coarseCount ? header.tileCount : 0};
+  uint64_t hash = payloadChecksum(fnvOffset, tiling.tiles.data(), tiling.tiles.size_bytes());
+  hash = payloadChecksum(hash, tiling.coarse.data(), tiling.coarse.size_bytes());
+  hash = payloadChecksum(hash, tiling.parent.data(), tiling.parent.size_bytes());
+  if (hash != header.payloadChecksum || !isConsistent(tiling.tiles, tiling.coarse, tiling.parent)) {
+    spdlog::warn("Ignoring corrupted cache file : {}.", path.string());
+    return {};
+  }
+  tiling.levels = {{header.frameRotation, header.frameScale}, header.tilesLevel, header.coarseLevel};
+  tiling.file = std::move(file);
+  spdlog::debug("Tiling loaded from cache : {}.", path.string());
+  return tiling;
+}
+
+// Write the tiling of key in directory. The file is written under a temporary name then renamed,
+// so concurrent processes never map a partial file. levels are only given with packed tiles.
+template <typename Record>
+bool store(const std::filesystem::path &directory, const Key &key, std::span<const Record> tiles, std::span<const Record> coarse, std::span<const uint32_t> parent, const PackedLevels &levels = {}) {
+  auto align = [](uint64_t offset) {
+    return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+  };
+  Header header = {};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.recordSize = sizeof(Record);
+  header.level = key.level;
+  header.step = key.step;
+  header.canvasWidth = key.canvasWidth;
+  header.canvasHeight = key.canvasHeight;
+  header.rhombus = key.rhombus;
+  header.exact = key.exact;
+  header.packed = key.packed;
+  header.wholeTiles = key.wholeTiles;
+  header.frameRotation = levels.frame.rotation;
+  header.frameScale = levels.frame.scale;
+  header.tilesLevel = levels.tiles;
+  header.coarseLevel = levels.coarse;
+  header.tileCount = tiles.size();
+  header.coarseCount = coarse.size();
+  header.tilesOffset = align(sizeof(Header));
+  header.coarseOffset = align(header.tilesOffset + tiles.size_bytes());
+  header.parentOffset = align(header.coarseOffset + coarse.size_bytes());
+  header.fileSize = header.parentOffset + parent.size_bytes();
+  header.payloadChecksum = payloadChecksum(fnvOffset, tiles.data(), tiles.size_bytes());
+  header.payloadChecksum = payloadChecksum(header.payloadChecksum, coarse.data(), coarse.size_bytes());
+  header.payloadChecksum = payloadChecksum(header.payloadChecksum, parent.data(), parent.size_bytes());
+  header.checksum = checksum(header);
+
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  const std::filesystem::path path = directory / filename(key);
+  const std::filesystem::path temporary = directory / fmt::format("{}.{:x}.tmp", filename(key), std::random_device{}());
+  std::FILE *file = std::fopen(temporary.string().c_str(), "wb");
+  if (!file) {
+    spdlog::warn("Cannot write cache file : {}.", path.string());
+    return false;
+  }
+  auto writeAt = [&](uint64_t offset, const void *data, size_t size) {
+    const std::vector<uint8_t> padding(offset - static_cast<uint64_t>(std::ftell(file)), 0);
+    return std::fwrite(padding.data(), 1, padding.size(), file) == padding.size() && std::fwrite(data, 1, size, file) == size;
+  };
+  bool ok = writeAt(0, &header, sizeof(Header)) &&
+            writeAt(header.tilesOffset, tiles.data(), tiles.size_bytes()) &&
+            writeAt(header.coarseOffset, coarse.data(), coarse.size_bytes()) &&
+            writeAt(header.parentOffset, parent.data(), parent.size_bytes());
+  ok = std::fclose(file) == 0 && ok;
+  if (ok) {
+    std::filesystem::rename(temporary, path, error);
+    ok = !error;
+  }
+  if (!ok) {
+    std::filesystem::remove(temporary, error);
+    spdlog::warn("Cannot write cache file : {}.", path.string());
+  }
+  return ok;
+}
+
+// In memory cache of the capacity most recently used values, shared by several threads. A value requested
+// by several threads at the same time is computed once, and a value stays alive while it is used after
+// its eviction. A failed computation is not cached, its exception is rethrown to all the waiting threads.
+template <typename K, typename Value>
+class LruCache {
+public:
+  explicit LruCache(size_t capacity)
+      : capacity(std::max<size_t>(capacity, 1)) {
+  }
+
+  // Cached value of key, compute() is called to produce it when it is missing
+  template <typename Compute>
+  std::shared_ptr<const Value> get(const K &key, Compute &&compute) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (auto found = index.find(key); found != index.end()) {
+      entries.splice(entries.begin(), entries, found->second);
+      std::shared_future<std::shared_ptr<const Value>> value = found->second->value;
+      lock.unlock();
+      stats::add("lru.hits", 1);
+      return value.get();
+    }
+    std::promise<std::shared_ptr<const Value>> promise;
+    const uint64_t generation = ++generations;
+    entries.push_front({key, promise.get_future().share(), generation});
+    index[key] = entries.begin();
+    if (entries.size() > capacity) {
+      index.erase(entries.back().key);
+      entries.pop_back();
+    }
+    lock.unlock();
+    stats::add("lru.misses", 1);
+
+    try {
+      std::shared_ptr<const Value> value = std::make_shared<const Value>(compute());
+      promise.set_value(value);
+      return value;
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+      lock.lock();
+      // the entry may have been evicted and requested again meanwhile
+      if (auto found = index.find(key); found != index.end() && found->second->generation == generation) {
+        entries.erase(found->second);
+        index.erase(found);
+      }
+      throw;
+    }
+  }
+
+private:
+  struct Entry {
+    K key;
+    std::shared_future<std::shared_ptr<const Value>> value;
+    uint64_t generation;
+  };
+
+  size_t capacity;
+  uint64_t generations = 0;
+  std::mutex mutex;
+  // most recently used first
+  std::list<Entry> entries;
+  std::map<K, typename std::list<Entry>::iterator> index;
+};
+
+} // namespace cache
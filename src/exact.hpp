@@ -0,0 +1,236 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <penrose.hpp>
+#include <stats.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace penrose {
+
+// Exact coordinate backend
+// A point is an element of Z[zeta] with zeta = exp(i pi / 5) : c0 + c1 zeta + c2 zeta^2 + c3 zeta^3.
+// Starting from triangles with vertices on 10th roots of unity, every vertex of the tiling stays in
+// this ring : 1/goldenRatio = zeta^2 - zeta^3 and mirrors along tiles edges are multiplications by
+// roots of unity. Comparison and hashing are exact, floats are only used at serialization.
+struct ExactPoint {
+  std::array<int32_t, 4> c;
+};
+
+inline ExactPoint operator+(const ExactPoint &pt1, const ExactPoint &pt2) {
+  return {{pt1.c[0] + pt2.c[0], pt1.c[1] + pt2.c[1], pt1.c[2] + pt2.c[2], pt1.c[3] + pt2.c[3]}};
+}
+inline ExactPoint operator-(const ExactPoint &pt1, const ExactPoint &pt2) {
+  return {{pt1.c[0] - pt2.c[0], pt1.c[1] - pt2.c[1], pt1.c[2] - pt2.c[2], pt1.c[3] - pt2.c[3]}};
+}
+inline ExactPoint operator*(const ExactPoint &pt1, const ExactPoint &pt2) {
+  // product of polynomials of degree 3, reduced with zeta^4 = -1 + zeta - zeta^2 + zeta^3,
+  // zeta^5 = -1 and zeta^6 = -zeta
+  std::array<int32_t, 7> p = {};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      p[i + j] += pt1.c[i] * pt2.c[j];
+    }
+  }
+  return {{p[0] - p[4] - p[5], p[1] + p[4] - p[6], p[2] - p[4], p[3] + p[4]}};
+}
+inline bool operator==(const ExactPoint &lhs, const ExactPoint &rhs) {
+  return lhs.c == rhs.c;
+}
+
+// zeta^k for any integer k
+inline ExactPoint unitRoot(int k) {
+  k = ((k % 10) + 10) % 10;
+  const int32_t sign = k < 5 ? 1 : -1;
+  switch (k % 5) {
+  case 0:
+    return {{sign, 0, 0, 0}};
+  case 4:
+    return {{-sign, sign, -sign, sign}};
+  default: {
+    ExactPoint pt = {{0, 0, 0, 0}};
+    pt.c[k % 5] = sign;
+    return pt;
+  }
+  }
+}
+
+inline ExactPoint conj(const ExactPoint &pt) {
+  // conj(zeta) = zeta^9 = 1 - zeta + zeta^2 - zeta^3, conj(zeta^2) = -zeta^3, conj(zeta^3) = -zeta^2
+  return {{pt.c[0] + pt.c[1], -pt.c[1], pt.c[1] - pt.c[3], -pt.c[1] - pt.c[2]}};
+}
+
+inline std::array<double, 2> toComplex(const ExactPoint &pt) {
+  // zeta^k for k in [0, 3], in double precision
+  constexpr std::array<double, 4> re = {1., 0.80901699437494742, 0.30901699437494742, -0.30901699437494742};
+  constexpr std::array<double, 4> im = {0., 0.58778525229247313, 0.95105651629515357, 0.95105651629515357};
+  return {pt.c[0] * re[0] + pt.c[1] * re[1] + pt.c[2] * re[2] + pt.c[3] * re[3],
+          pt.c[0] * im[0] + pt.c[1] * im[1] + pt.c[2] * im[2] + pt.c[3] * im[3]};
+}
+
+// Point at 1/goldenRatio of the way from A to B
+inline ExactPoint goldenSplit(const ExactPoint &A, const ExactPoint &B) {
+  const ExactPoint inverseGoldenRatio = {{0, 0, 1, -1}};
+  return A + (B - A) * inverseGoldenRatio;
+}
+
+// Whether every child vertex on an edge of the rules of Tiling is a golden ratio split
+template <typename Tiling>
+constexpr bool hasOnlyGoldenSplits() {
+  for (const auto &rule : Tiling::rules) {
+    for (size_t child = 0; child < rule.count; ++child) {
+      for (const RuleVertex &vertex : rule.children[child].vertices) {
+        if (vertex.from != vertex.to && vertex.divisor != goldenRatio) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(hasOnlyGoldenSplits<KiteDart>() && hasOnlyGoldenSplits<Rhombus>(), "Exact coordinates only support golden ratio splits");
+
+// Point at 1/divisor of the way from A to B, the divisor of the rules is always the golden ratio
+inline ExactPoint pointOnSegment(const ExactPoint &A, const ExactPoint &B, float) {
+  return goldenSplit(A, B);
+}
+
+// Mirror of A along the line BC
+inline ExactPoint mirror(const ExactPoint &A, const ExactPoint &B, const ExactPoint &C) {
+  // BC direction is a multiple of pi/10, the mirror along a line of angle k pi / 10 is z -> zeta^k conj(z)
+  const auto [re, im] = toComplex(C - B);
+  const int k = static_cast<int>(std::lround(std::atan2(im, re) / (pi / 10.)));
+  return B + unitRoot(k) * conj(A - B);
+}
+
+using ExactTriangle = BasicPenroseTriangle<ExactPoint>;
+using ExactQuadrilateral = BasicPenroseQuadrilateral<ExactPoint>;
+
+// Placement of the exact coordinates in the plane
+struct Frame {
+  Point origin;
+  float scale;
+  float rotation;
+};
+
+inline Point toPoint(const ExactPoint &pt, const Frame &frame) {
+  const auto [re, im] = toComplex(pt);
+  const double cosR = std::cos(frame.rotation);
+  const double sinR = std::sin(frame.rotation);
+  return frame.origin + frame.scale * Point(static_cast<float>(re * cosR - im * sinR), static_cast<float>(re * sinR + im * cosR));
+}
+
+inline std::vector<PenroseQuadrilateral> toFloat(const std::vector<ExactQuadrilateral> &quadrilaterals, const Frame &frame) {
+  std::vector<PenroseQuadrilateral> newList;
+  newList.reserve(quadrilaterals.size());
+  for (const auto &quad : quadrilaterals) {
+    newList.emplace_back(quad.color, toPoint(quad.vertices[0], frame), toPoint(quad.vertices[1], frame), toPoint(quad.vertices[2], frame), toPoint(quad.vertices[3], frame), quad.flag);
+  }
+  return newList;
+}
+
+inline uint64_t hash(const ExactPoint &pt) {
+  uint64_t key = 0;
+  for (int32_t c : pt.c) {
+    // splitmix64 step on each coefficient
+    key += static_cast<uint32_t>(c) + 0x9e3779b97f4a7c15ull;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    key ^= key >> 31;
+  }
+  return key;
+}
+
+// Remove quadrilaterals with the same vertices than a previous one, the first occurrence is kept.
+// The sum of the vertices is an exact key, so there is no tolerance involved.
+// Return the number of removed duplicates.
+inline size_t removeDuplicates(std::vector<ExactQuadrilateral> &quadrilaterals) {
+  constexpr uint32_t emptySlot = std::numeric_limits<uint32_t>::max();
+  size_t capacity = 16;
+  while (capacity < 2 * quadrilaterals.size()) {
+    capacity <<= 1;
+  }
+  const size_t mask = capacity - 1;
+  std::vector<uint32_t> table(capacity, emptySlot);
+  std::vector<ExactPoint> keys;
+  keys.reserve(quadrilaterals.size());
+
+  size_t kept = 0;
+  for (size_t idx = 0; idx < quadrilaterals.size(); ++idx) {
+    const auto &v = quadrilaterals[idx].vertices;
+    const ExactPoint key = v[0] + v[1] + v[2] + v[3];
+    size_t pos = hash(key) & mask;
+    while (table[pos] != emptySlot && !(keys[table[pos]] == key)) {
+      pos = (pos + 1) & mask;
+    }
+    if (table[pos] != emptySlot) {
+      continue;
+    }
+    table[pos] = static_cast<uint32_t>(kept);
+    keys.push_back(key);
+    if (kept != idx) {
+      quadrilaterals[kept] = quadrilaterals[idx];
+    }
+    ++kept;
+  }
+
+  const size_t duplicates = quadrilaterals.size() - kept;
+  quadrilaterals.erase(quadrilaterals.begin() + kept, quadrilaterals.end());
+  return duplicates;
+}
+
+// Deflate level times and drop triangles outside clip before their subdivision, clip is in the frame coordinates
+inline std::vector<ExactTriangle> deflate(const std::vector<ExactTriangle> &triangles, int level, const Frame &frame, const Rectangle &clip) {
+  float longest = 0.f;
+  for (const auto &triangle : triangles) {
+    for (size_t v = 0; v < 3; ++v) {
+      longest = std::max(longest, norm(toPoint(triangle.vertices[v], frame) - toPoint(triangle.vertices[(v + 1) % 3], frame)));
+    }
+  }
+  // final tiles stick out of their triangle by less than 2 final edges
+  const Rectangle area = expand(clip, 2.f * longest / std::pow(inflation, static_cast<float>(level)));
+  auto outside = [&](const ExactTriangle &triangle) {
+    const Triangle placed(toPoint(triangle.vertices[0], frame), toPoint(triangle.vertices[1], frame), toPoint(triangle.vertices[2], frame));
+    return !intersects(area, boundingBox(placed));
+  };
+
+  std::vector<ExactTriangle> current = triangles;
+  std::vector<ExactTriangle> next;
+  std::erase_if(current, outside);
+  for (int l = 0; l < level; ++l) {
+    deflate(current, next);
+    std::erase_if(next, outside);
+    std::swap(current, next);
+  }
+  return current;
+}
+
+inline std::vector<ExactQuadrilateral> deflateAndMerge(const std::vector<ExactTriangle> &triangles, int level, const Frame &frame, const std::optional<Rectangle> &clip = {}) {
+  // at least one deflation is always done
+  level = std::max(level, 1);
+  const stats::Timer timer("exactDeflate");
+  std::vector<ExactQuadrilateral> quadTiling = completeShape(clip ? deflate(triangles, level, frame, *clip) : deflate(triangles, level));
+
+  const size_t duplicates = removeDuplicates(quadTiling);
+  stats::add("duplicates", duplicates);
+  stats::add("tiles", quadTiling.size());
+  spdlog::debug("deflateAndMerge: {} exact tiles, {} duplicated halves merged", quadTiling.size(), duplicates);
+
+  return quadTiling;
+}
+
+} // namespace penrose
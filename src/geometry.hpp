@@ -12,8 +12,11 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <optional>
+#include <span>
 #include <string>
 
 constexpr float epsilon = 0.1f; // use for the comparison between Point
@@ -27,90 +30,137 @@ struct Point {
   }
 };
 
-Point operator+(const Point &pt1, const Point &pt2) {
+inline Point operator+(const Point &pt1, const Point &pt2) {
   return {pt1.x + pt2.x, pt1.y + pt2.y};
 }
-Point operator-(const Point &pt1, const Point &pt2) {
+inline Point operator-(const Point &pt1, const Point &pt2) {
   return {pt1.x - pt2.x, pt1.y - pt2.y};
 }
-Point operator*(float value, const Point &pt) {
+inline Point operator*(float value, const Point &pt) {
   return {value * pt.x, value * pt.y};
 }
-Point operator*(const Point &pt, float value) {
+inline Point operator*(const Point &pt, float value) {
   return {value * pt.x, value * pt.y};
 }
-Point operator/(const Point &pt, float value) {
+inline Point operator/(const Point &pt, float value) {
   return {pt.x / value, pt.y / value};
 }
-float scalar(const Point &pt1, const Point &pt2) {
+inline float scalar(const Point &pt1, const Point &pt2) {
   return pt1.x * pt2.x + pt1.y * pt2.y;
 }
-float normSq(const Point &pt1) {
+inline float normSq(const Point &pt1) {
   return pt1.x * pt1.x + pt1.y * pt1.y;
 }
-float norm(const Point &pt1) {
+inline float norm(const Point &pt1) {
   return std::sqrt(pt1.x * pt1.x + pt1.y * pt1.y);
 }
-Point turn90(const Point &pt) {
+inline Point turn90(const Point &pt) {
   return {- pt.y, pt.x};
 }
-bool operator==(const Point &lhs, const Point &rhs) {
+inline bool operator==(const Point &lhs, const Point &rhs) {
   return normSq(lhs - rhs) < epsilon;
 }
-bool operator<(const Point &lhs, const Point &rhs) {
+inline bool operator<(const Point &lhs, const Point &rhs) {
   if (abs(lhs.x - rhs.x) < epsilon)
     return lhs.y < rhs.y;
   return lhs.x < rhs.x;
 }
 
-struct Triangle {
-  std::array<Point, 3> vertices;
+// Shapes are templated on the point type, so an exact coordinate backend can reuse them
+template <typename PointT>
+struct BasicTriangle {
+  std::array<PointT, 3> vertices;
 
-  Triangle(Point A, Point B, Point C)
+  BasicTriangle(PointT A, PointT B, PointT C)
       : vertices{A, B, C} {
   }
 
-  Point center() {
+  PointT center() {
     return (this->vertices[0] + this->vertices[1] + this->vertices[2]) / 3.;
   }
 };
 
-bool operator==(const Triangle &lhs, const Triangle &rhs) {
+using Triangle = BasicTriangle<Point>;
+
+inline bool operator==(const Triangle &lhs, const Triangle &rhs) {
   return rhs.vertices[0] == lhs.vertices[0] &&
          rhs.vertices[1] == lhs.vertices[1] &&
          rhs.vertices[2] == lhs.vertices[2];
 }
 
-struct Quadrilateral {
-  std::array<Point, 4> vertices;
+template <typename PointT>
+struct BasicQuadrilateral {
+  std::array<PointT, 4> vertices;
 
-  Quadrilateral(Point A, Point B, Point C, Point D)
+  BasicQuadrilateral(PointT A, PointT B, PointT C, PointT D)
       : vertices{A, B, C, D} {
   }
 
-  Point center() const {
+  PointT center() const {
     return (this->vertices[0] + this->vertices[1] + this->vertices[2] + this->vertices[3]) / 4.;
   }
 };
 
-bool operator==(const Quadrilateral &lhs, const Quadrilateral &rhs) {
+using Quadrilateral = BasicQuadrilateral<Point>;
+
+inline bool operator==(const Quadrilateral &lhs, const Quadrilateral &rhs) {
   // we compare gravity center approximative be enough
   return lhs.center() == rhs.center();
 }
 
-bool operator<(const Quadrilateral &lhs, const Quadrilateral &rhs) {
+inline bool operator<(const Quadrilateral &lhs, const Quadrilateral &rhs) {
   // we compare gravity center approximative be enough
   return lhs.center() < rhs.center();
 }
 
-std::string to_string(const Point &pt) {
+// Open path through points, the points are owned by the caller
+struct Polyline {
+  std::span<const Point> points;
+};
+
+struct Rectangle {
+  Point min;
+  Point max;
+
+  Rectangle(Point min, Point max)
+      : min(min), max(max) {
+  }
+};
+
+inline Rectangle expand(const Rectangle &rect, float margin) {
+  return {rect.min - Point(margin, margin), rect.max + Point(margin, margin)};
+}
+
+inline bool intersects(const Rectangle &lhs, const Rectangle &rhs) {
+  return lhs.min.x <= rhs.max.x && rhs.min.x <= lhs.max.x &&
+         lhs.min.y <= rhs.max.y && rhs.min.y <= lhs.max.y;
+}
+
+inline bool contains(const Rectangle &outer, const Rectangle &inner) {
+  return outer.min.x <= inner.min.x && inner.max.x <= outer.max.x &&
+         outer.min.y <= inner.min.y && inner.max.y <= outer.max.y;
+}
+
+inline Rectangle boundingBox(const Triangle &triangle) {
+  const auto &[A, B, C] = triangle.vertices;
+  return {{std::min({A.x, B.x, C.x}), std::min({A.y, B.y, C.y})},
+          {std::max({A.x, B.x, C.x}), std::max({A.y, B.y, C.y})}};
+}
+
+inline Rectangle boundingBox(const Quadrilateral &quad) {
+  const auto &[A, B, C, D] = quad.vertices;
+  return {{std::min({A.x, B.x, C.x, D.x}), std::min({A.y, B.y, C.y, D.y})},
+          {std::max({A.x, B.x, C.x, D.x}), std::max({A.y, B.y, C.y, D.y})}};
+}
+
+inline std::string to_string(const Point &pt) {
   return fmt::format("({}, {})", pt.x, pt.y);
 }
 
-std::string to_string(const Triangle &triangle) {
+inline std::string to_string(const Triangle &triangle) {
   return fmt::format("{}, {}, {}", to_string(triangle.vertices[0]), to_string(triangle.vertices[1]), to_string(triangle.vertices[2]));
 }
 
-std::string to_string(const Quadrilateral &quad) {
+inline std::string to_string(const Quadrilateral &quad) {
   return fmt::format("{}, {}, {}, {}", to_string(quad.vertices[0]), to_string(quad.vertices[1]), to_string(quad.vertices[2]), to_string(quad.vertices[3]));
 }
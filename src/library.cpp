@@ -0,0 +1,362 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#include <library.hpp>
+
+#include <geometry.hpp>
+#include <packed.hpp>
+#include <penrose.hpp>
+#include <rng.hpp>
+#include <save.hpp>
+#include <wallpaper.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+static_assert(sizeof(penrose_tile) == 36, "tiles of the C interface are expected to take 36 bytes");
+static_assert(sizeof(penrose_packed_tile) == sizeof(penrose::PackedTriangle), "packed tiles of the C interface are expected to take 12 bytes");
+static_assert(PENROSE_SHAPE_COUNT == 4 * penrose::orientationCount, "a shape is expected per kind and orientation");
+
+namespace penrose::library {
+
+namespace {
+
+// the tile count of deeper levels does not fit in size_t
+constexpr int maxLevel = 40;
+
+void check(const Options &options) {
+  if (options.level < 0 || options.level > maxLevel) {
+    throw std::invalid_argument(fmt::format("Level must be in [0, {}] : {}", maxLevel, options.level));
+  }
+  if (options.width <= 0 || options.height <= 0) {
+    throw std::invalid_argument(fmt::format("Canvas size must be positive : {}x{}", options.width, options.height));
+  }
+}
+
+// level 0 is drawn like level 1, as the command line does
+int streamLevel(const Options &options) {
+  return std::max(options.level, 1);
+}
+
+Tile asTile(const PenroseQuadrilateral &quad) {
+  Tile tile = {};
+  for (size_t v = 0; v < quad.vertices.size(); ++v) {
+    tile.x[v] = quad.vertices[v].x;
+    tile.y[v] = quad.vertices[v].y;
+  }
+  tile.kind = static_cast<uint8_t>(quad.color);
+  tile.flag = quad.flag;
+  return tile;
+}
+
+PenroseQuadrilateral fromTile(const Tile &tile) {
+  if (tile.kind > static_cast<uint8_t>(TriangleKind::kRhombsViolet)) {
+    throw std::invalid_argument(fmt::format("Invalid tile kind : {}", tile.kind));
+  }
+  return PenroseQuadrilateral(static_cast<TriangleKind>(tile.kind),
+                              Point(tile.x[0], tile.y[0]), Point(tile.x[1], tile.y[1]),
+                              Point(tile.x[2], tile.y[2]), Point(tile.x[3], tile.y[3]),
+                              tile.flag != 0);
+}
+
+// Shapes of the tiles of the tiling, the frame of the packed deflation of the initial patch
+PackedLevel shapeTable(const Options &options) {
+  return PackedLevel(pack(initialPatch(options.rhombus, {options.width, options.height})).frame, streamLevel(options));
+}
+
+PackedTile asPackedTile(const PenroseQuadrilateral &quad, const PackedLevel &table) {
+  const PenroseTriangle triangle(quad.color, quad.vertices[0], quad.vertices[1], quad.vertices[2]);
+  return {quad.vertices[0].x, quad.vertices[0].y, static_cast<uint8_t>(quad.color), table.orientationOf(triangle), static_cast<uint8_t>(quad.flag), 0};
+}
+
+PenroseQuadrilateral fromPackedTile(const PackedTile &tile, const PackedLevel &table) {
+  if (tile.kind > static_cast<uint8_t>(TriangleKind::kRhombsViolet) || tile.orientation >= orientationCount) {
+    throw std::invalid_argument(fmt::format("Invalid packed tile kind or orientation : {}, {}", tile.kind, tile.orientation));
+  }
+  const auto &[A, B, C, D] = table.vertices({tile.x, tile.y, tile.kind, tile.orientation, tile.flag != 0}).vertices;
+  return PenroseQuadrilateral(static_cast<TriangleKind>(tile.kind), A, B, C, D, tile.flag != 0);
+}
+
+// Svg document of the tiles given by forEach(consumer), styled like --stream
+template <typename ForEach>
+void writeTiles(const Options &options, const Style &style, const Writer &write, ForEach &&forEach) {
+  check(options);
+  const Canvas canvas = {options.width, options.height};
+  svg::Document doc(viewport(canvas), background, style.precision >= 0 ? std::optional<int>(std::min(style.precision, 6)) : std::nullopt);
+  doc.open(write);
+  const SingleLevelLayers layers = addSingleLevelLayers(doc, firstTile(initialPatch(options.rhombus, canvas), streamLevel(options)), style.neon);
+  const rng::Generator holes(style.seed, holeStream);
+  forEach([&](const PenroseQuadrilateral &quad) {
+    layers.add(doc, quad, isAboveThreshold(holes, quad.center(), style.threshold));
+  });
+  doc.finish();
+}
+
+// Call consumer on each tile overlapping the canvas, depth first
+template <typename Consumer>
+void forEachCanvasTile(const Options &options, Consumer &&consumer) {
+  const Canvas canvas = {options.width, options.height};
+  forEachTile(initialPatch(options.rhombus, canvas), streamLevel(options), VisitAll{}, consumer, viewport(canvas));
+}
+
+} // namespace
+
+size_t maxTiles(const Options &options) {
+  check(options);
+  // each tile is produced by one of the triangles of the last level
+  const std::vector<PenroseTriangle> patch = initialPatch(options.rhombus, {options.width, options.height});
+  return total(countAfterDeflation(countKinds(patch), streamLevel(options)));
+}
+
+size_t generate(const Options &options, std::span<Tile> tiles) {
+  check(options);
+  size_t count = 0;
+  forEachCanvasTile(options, [&](const PenroseQuadrilateral &quad) {
+    if (count < tiles.size()) {
+      tiles[count] = asTile(quad);
+    }
+    ++count;
+  });
+  return count;
+}
+
+size_t generatePacked(const Options &options, std::span<PackedTile> tiles) {
+  check(options);
+  const PackedLevel table = shapeTable(options);
+  size_t count = 0;
+  forEachCanvasTile(options, [&](const PenroseQuadrilateral &quad) {
+    if (count < tiles.size()) {
+      tiles[count] = asPackedTile(quad, table);
+    }
+    ++count;
+  });
+  return count;
+}
+
+void tileShapes(const Options &options, std::span<TileShape, shapeCount> shapes) {
+  check(options);
+  const PackedLevel table = shapeTable(options);
+  for (uint8_t kind = 0; kind < 4; ++kind) {
+    for (uint8_t orientation = 0; orientation < orientationCount; ++orientation) {
+      const Quadrilateral &vertices = table.shape({0, 0, kind, orientation, false}).vertices;
+      TileShape &shape = shapes[kind * orientationCount + orientation];
+      for (size_t v = 0; v < vertices.vertices.size(); ++v) {
+        shape.x[v] = vertices.vertices[v].x;
+        shape.y[v] = vertices.vertices[v].y;
+      }
+    }
+  }
+}
+
+void writeSvg(const Options &options, std::span<const Tile> tiles, const Style &style, const Writer &write) {
+  writeTiles(options, style, write, [&](auto &&consumer) {
+    for (const Tile &tile : tiles) {
+      consumer(fromTile(tile));
+    }
+  });
+}
+
+void writePackedSvg(const Options &options, std::span<const PackedTile> tiles, const Style &style, const Writer &write) {
+  check(options);
+  const PackedLevel table = shapeTable(options);
+  writeTiles(options, style, write, [&](auto &&consumer) {
+    for (const PackedTile &tile : tiles) {
+      consumer(fromPackedTile(tile, table));
+    }
+  });
+}
+
+size_t writeSvg(const Options &options, std::span<const Tile> tiles, const Style &style, std::span<char> buffer) {
+  size_t size = 0;
+  writeSvg(options, tiles, style, [&](const char *bytes, size_t count) {
+    if (size < buffer.size()) {
+      std::memcpy(buffer.data() + size, bytes, std::min(count, buffer.size() - size));
+    }
+    size += count;
+    return true;
+  });
+  return size;
+}
+
+} // namespace penrose::library
+
+// =================================================================================================
+// C interface
+
+using namespace penrose;
+
+namespace {
+
+thread_local std::string lastError;
+
+penrose_status fail(penrose_status status, const char *message) {
+  lastError = message;
+  return status;
+}
+
+// Run function and convert its exceptions to a status
+template <typename Function>
+penrose_status guard(Function &&function) {
+  try {
+    lastError.clear();
+    return function();
+  } catch (const std::invalid_argument &e) {
+    return fail(PENROSE_INVALID_ARGUMENT, e.what());
+  } catch (const std::bad_alloc &) {
+    return fail(PENROSE_ERROR, "Out of memory");
+  } catch (const std::exception &e) {
+    return fail(PENROSE_ERROR, e.what());
+  } catch (...) {
+    return fail(PENROSE_ERROR, "Unknown error");
+  }
+}
+
+library::Options toOptions(const penrose_options *options) {
+  if (!options) {
+    throw std::invalid_argument("Options are required");
+  }
+  return {options->rhombus != 0, options->level, options->width, options->height};
+}
+
+library::Style toStyle(const penrose_style *style) {
+  if (!style) {
+    return {};
+  }
+  return {style->threshold, style->neon != 0, style->seed, style->precision};
+}
+
+template <typename T>
+std::span<const T> toTiles(const T *tiles, size_t count) {
+  if (!tiles && count != 0) {
+    throw std::invalid_argument("Tiles are required");
+  }
+  return {tiles, count};
+}
+
+// Writer calling write(context, bytes, size), writeFailed is set once it refuses bytes
+library::Writer toWriter(penrose_write_fn write, void *context, bool &writeFailed) {
+  if (!write) {
+    throw std::invalid_argument("A write callback is required");
+  }
+  return [write, context, &writeFailed](const char *bytes, size_t size) {
+    writeFailed = write(context, bytes, size) == 0;
+    return !writeFailed;
+  };
+}
+
+} // namespace
+
+extern "C" {
+
+void penrose_default_options(penrose_options *options) {
+  if (options) {
+    const library::Options defaults;
+    *options = {defaults.rhombus, defaults.level, defaults.width, defaults.height};
+  }
+}
+
+void penrose_default_style(penrose_style *style) {
+  if (style) {
+    const library::Style defaults;
+    *style = {defaults.threshold, defaults.neon, defaults.seed, defaults.precision};
+  }
+}
+
+size_t penrose_max_tiles(const penrose_options *options) {
+  size_t count = 0;
+  guard([&] {
+    count = library::maxTiles(toOptions(options));
+    return PENROSE_OK;
+  });
+  return count;
+}
+
+penrose_status penrose_generate(const penrose_options *options, penrose_tile *tiles, size_t capacity, size_t *count) {
+  return guard([&] {
+    if (!tiles && capacity != 0) {
+      throw std::invalid_argument("Tiles are required");
+    }
+    const size_t generated = library::generate(toOptions(options), {tiles, capacity});
+    if (count) {
+      *count = generated;
+    }
+    return generated > capacity ? fail(PENROSE_BUFFER_TOO_SMALL, "Tiles do not fit in capacity") : PENROSE_OK;
+  });
+}
+
+penrose_status penrose_generate_packed(const penrose_options *options, penrose_packed_tile *tiles, size_t capacity, size_t *count) {
+  return guard([&] {
+    if (!tiles && capacity != 0) {
+      throw std::invalid_argument("Tiles are required");
+    }
+    const size_t generated = library::generatePacked(toOptions(options), {tiles, capacity});
+    if (count) {
+      *count = generated;
+    }
+    return generated > capacity ? fail(PENROSE_BUFFER_TOO_SMALL, "Tiles do not fit in capacity") : PENROSE_OK;
+  });
+}
+
+penrose_status penrose_tile_shapes(const penrose_options *options, penrose_tile_shape *shapes) {
+  return guard([&] {
+    if (!shapes) {
+      throw std::invalid_argument("Shapes are required");
+    }
+    library::tileShapes(toOptions(options), std::span<penrose_tile_shape, PENROSE_SHAPE_COUNT>(shapes, PENROSE_SHAPE_COUNT));
+    return PENROSE_OK;
+  });
+}
+
+penrose_status penrose_write_svg(const penrose_options *options, const penrose_tile *tiles, size_t count,
+                                 const penrose_style *style, penrose_write_fn write, void *context) {
+  bool writeFailed = false;
+  const penrose_status status = guard([&] {
+    library::writeSvg(toOptions(options), toTiles(tiles, count), toStyle(style), toWriter(write, context, writeFailed));
+    return PENROSE_OK;
+  });
+  return writeFailed ? PENROSE_WRITE_ERROR : status;
+}
+
+penrose_status penrose_write_packed_svg(const penrose_options *options, const penrose_packed_tile *tiles, size_t count,
+                                        const penrose_style *style, penrose_write_fn write, void *context) {
+  bool writeFailed = false;
+  const penrose_status status = guard([&] {
+    library::writePackedSvg(toOptions(options), toTiles(tiles, count), toStyle(style), toWriter(write, context, writeFailed));
+    return PENROSE_OK;
+  });
+  return writeFailed ? PENROSE_WRITE_ERROR : status;
+}
+
+penrose_status penrose_write_svg_buffer(const penrose_options *options, const penrose_tile *tiles, size_t count,
+                                        const penrose_style *style, char *buffer, size_t capacity, size_t *size) {
+  return guard([&] {
+    if (!buffer && capacity != 0) {
+      throw std::invalid_argument("A buffer is required");
+    }
+    const size_t written = library::writeSvg(toOptions(options), toTiles(tiles, count), toStyle(style), std::span<char>(buffer, capacity));
+    if (size) {
+      *size = written;
+    }
+    return written > capacity ? fail(PENROSE_BUFFER_TOO_SMALL, "Document does not fit in capacity") : PENROSE_OK;
+  });
+}
+
+const char *penrose_last_error(void) {
+  return lastError.c_str();
+}
+
+} // extern "C"
@@ -0,0 +1,82 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <penrose_c.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+
+// Public C++ interface of the penrose library. It only depends on the standard library and on the
+// C interface, the generation headers are not needed to use it. Errors are reported by exceptions,
+// std::invalid_argument for invalid options and std::runtime_error when the output cannot be written.
+namespace penrose::library {
+
+// Tile with its 4 vertices in canvas pixels, the same layout than the C interface
+using Tile = penrose_tile;
+
+// Tile packed in 12 bytes, its first vertex, kind and orientation, the same layout than the C interface
+using PackedTile = penrose_packed_tile;
+
+// Offsets of the vertices of a packed tile from its first one
+using TileShape = penrose_tile_shape;
+
+// Shapes indexed by kind * 20 + orientation
+constexpr size_t shapeCount = PENROSE_SHAPE_COUNT;
+
+struct Options {
+  // rhombs (P3) instead of kites and darts (P2)
+  bool rhombus = false;
+  int level = 11;
+  // canvas size in pixels
+  int width = 2000;
+  int height = 2000;
+};
+
+// Styling of the single level wallpaper, like the command line with --stream
+struct Style {
+  // holes in [0, 10], 0 for no holes
+  int threshold = 7;
+  bool neon = false;
+  uint64_t seed = 0;
+  // decimals of the compact path encoding, negative for full coordinates
+  int precision = -1;
+};
+
+// Receives the document chunk after chunk, returns false when the bytes cannot be written
+using Writer = std::function<bool(const char *bytes, size_t size)>;
+
+// Upper bound of the number of tiles written by generate, to size the caller memory once
+PENROSE_API size_t maxTiles(const Options &options);
+
+// Write the tiles overlapping the canvas to tiles, depth first without keeping the tiling in memory.
+// Return the number of tiles of the tiling, when it is above tiles.size() only the first tiles are written.
+PENROSE_API size_t generate(const Options &options, std::span<Tile> tiles);
+
+// generate writing packed tiles, a third of the memory of Tile
+PENROSE_API size_t generatePacked(const Options &options, std::span<PackedTile> tiles);
+
+// Shapes of the packed tiles generated with options
+PENROSE_API void tileShapes(const Options &options, std::span<TileShape, shapeCount> shapes);
+
+// Svg document of tiles generated with options, streamed to write in chunks
+PENROSE_API void writeSvg(const Options &options, std::span<const Tile> tiles, const Style &style, const Writer &write);
+
+// writeSvg of packed tiles
+PENROSE_API void writePackedSvg(const Options &options, std::span<const PackedTile> tiles, const Style &style, const Writer &write);
+
+// Svg document written to buffer. Return the document size, when it is above buffer.size() only the
+// beginning of the document is written.
+PENROSE_API size_t writeSvg(const Options &options, std::span<const Tile> tiles, const Style &style, std::span<char> buffer);
+
+} // namespace penrose::library
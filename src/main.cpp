@@ -8,127 +8,539 @@
 //  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
 //
 
+#include <cache.hpp>
+#include <exact.hpp>
 #include <geometry.hpp>
+#include <packed.hpp>
+#include <parallel.hpp>
 #include <penrose.hpp>
+#include <raster.hpp>
+#include <rng.hpp>
 #include <save.hpp>
+#include <server.hpp>
+#include <stats.hpp>
+#include <wallpaper.hpp>
 
 #include <cxxopts.hpp>
 #include <spdlog/cfg/env.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ranges>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <optional>
 
-enum class IsHole : bool { Yes, No };
+using namespace penrose;
 
-int main(int argc, char *argv[]) try {
+#if defined(PENROSE_STATS)
+// Allocations are counted for --stats
+STATS_REPLACE_OPERATOR_NEW(stats::addAllocation)
+#endif
 
-  spdlog::cfg::load_env_levels();
+namespace {
 
-  // =================================================================================================
-  // CLI
-  cxxopts::Options options(argv[0], "Description");
+// exact coordinates have their vertices on 10th roots of unity rotated by pi/10
+Frame exactFrame(const Canvas &canvas) {
+  return {patchCenter(canvas), patchRadius(canvas), pi / 10};
+}
+
+// Options that change the tiling geometry, variants with the same key share it
+struct GeometryKey {
+  int level;
+  int step;
+  bool rhombus;
+  bool exact;
+  bool packed;
+  bool wholeTiles;
+  Canvas canvas;
+
+  auto operator<=>(const GeometryKey &) const = default;
+};
+
+// Coarse and fine levels deflated with --step, each step deflates at least once
+std::pair<int, int> stepLevels(int level, int step) {
+  const int coarseLevel = std::max(step, 1);
+  return {coarseLevel, coarseLevel + std::max(level - step, 1)};
+}
+
+// Deepest level deflated for key, whatever the backend or --stream
+int deflatedLevel(const GeometryKey &key) {
+  return key.step != 0 ? stepLevels(key.level, key.step).second : std::max(key.level, 1);
+}
+
+struct Variant {
+  GeometryKey key;
+  std::string filename;
+  int threshold;
+  bool neon;
+  bool stream;
+  bool compact;
+  int precision;
+  uint64_t seed;
+  // the canvas is written as rows x columns separate images
+  int tileRows;
+  int tileColumns;
+  // zoom animation into the canvas center, 0 frames for a still image
+  int frames;
+  float zoomPerFrame;
+
+  bool tiled() const {
+    return tileRows * tileColumns > 1;
+  }
+};
+
+// Strokes of tiles with each edge shared by 2 tiles once, the polylines point into points
+struct Edges {
+  std::vector<Point> points;
+  std::vector<Polyline> polylines;
+};
+
+template <typename Tiles>
+Edges chainEdges(const Tiles &tiles) {
+  Edges edges;
+  edges.polylines = chainEdges(buildMesh(tiles), edges.points);
+  return edges;
+}
+
+// Deflated and merged tiling, read only once computed
+struct Geometry {
+  std::span<const PenroseQuadrilateral> tiles;
+  // tiles of the first step and the index of the first step tile each tile comes from
+  std::span<const PenroseQuadrilateral> coarse;
+  std::span<const uint32_t> parent;
+  // tiles and coarse tiles of the packed backends, used instead of tiles and coarse when tilesTable is set.
+  // Their vertices are only rebuilt from the tables while they are drawn.
+  std::span<const PackedTriangle> packedTiles;
+  std::span<const PackedTriangle> packedCoarse;
+  cache::PackedLevels packedLevels = {};
+  std::optional<PackedLevel> tilesTable;
+  std::optional<PackedLevel> coarseTable;
+
+  // storage of the spans, computed tiles or a cache file mapped in memory
+  std::vector<PenroseQuadrilateral> computedTiles;
+  std::vector<PenroseQuadrilateral> computedCoarse;
+  std::vector<PackedTriangle> computedPackedTiles;
+  std::vector<PackedTriangle> computedPackedCoarse;
+  std::vector<uint32_t> computedParent;
+  cache::MappedFile cacheFile;
+  // edges of the tiles and of the first step tiles, only kept by the server, otherwise they are chained while drawn
+  std::optional<Edges> tileEdges;
+  std::optional<Edges> coarseEdges;
+
+  Geometry() = default;
+  Geometry(const Geometry &) = delete;
+  Geometry(Geometry &&) = default;
+
+  void setPacked(std::span<const PackedTriangle> tiles, std::span<const PackedTriangle> coarse, const cache::PackedLevels &levels) {
+    packedTiles = tiles;
+    packedCoarse = coarse;
+    packedLevels = levels;
+    tilesTable.emplace(levels.frame, levels.tiles);
+    coarseTable.emplace(levels.frame, levels.coarse);
+  }
+
+  // Call function(tiles, coarse) with the quadrilaterals, or with views rebuilding them from the packed tiles
+  template <typename Function>
+  void visit(Function &&function) const {
+    if (tilesTable) {
+      function(quadrilateralView(packedTiles, *tilesTable), quadrilateralView(packedCoarse, *coarseTable));
+    } else {
+      function(tiles, coarse);
+    }
+  }
+};
+
+// Whether the deflation of key gives packed tiles, the float --step always comes from a packed hierarchy
+bool isPacked(const GeometryKey &key) {
+  return !key.exact && (key.packed || key.step != 0);
+}
+
+cxxopts::Options makeOptions(const char *name) {
+  cxxopts::Options options(name, "Description");
   options.positional_help("output [level]").show_positional_help();
 
   // clang-format off
   options.add_options()
     ("h,help", "Print help")
     ("l,level", "Number of subdivision done", cxxopts::value<int>()->default_value("11"))
-    ("o,output", "Output filename (.svg)", cxxopts::value<std::string>())
+    ("o,output", "Output filename (.svg, .png or .ppm)", cxxopts::value<std::string>())
     ("rhombus", "Use Rhombus (P3) form otherwise it use Kite and Dart (P2)", cxxopts::value<bool>())
     ("neon", "Print only the shape border", cxxopts::value<bool>())
     ("step", "Step of the 2 color", cxxopts::value<int>()->default_value("0"))
     ("threshold", "Threshold for holes [0, 10] (0: no holes)", cxxopts::value<int>()->default_value("7"))
+    ("threads", "Number of threads used for the deflation (0: all cores)", cxxopts::value<int>()->default_value("0"))
+    ("stream", "Generate tiles depth first without keeping the whole tiling in memory", cxxopts::value<bool>())
+    ("exact", "Use exact algebraic coordinates for the deflation (ignored with --stream)", cxxopts::value<bool>())
+    ("packed", "Deflate packed 12 bytes triangles to reduce the memory used (always used with --step, ignored with --stream and --exact)", cxxopts::value<bool>())
+    ("whole-tiles", "Deflate whole tiles, each tile is produced once and no duplicate is removed (ignored with --step, --stream, --exact and --packed)", cxxopts::value<bool>())
+    ("canvas", "Canvas size in pixels, WIDTHxHEIGHT or a single size for a square canvas", cxxopts::value<std::string>()->default_value("2000"))
+    ("tiles", "Split the canvas in ROWSxCOLUMNS images generated in parallel like --stream, a json index lists them", cxxopts::value<std::string>()->default_value("1x1"))
+    ("frames", "Number of frames of a zoom animation into the center, output.svg gives output-0000.svg, ... (--tiles and --step are ignored)", cxxopts::value<int>()->default_value("0"))
+    ("zoom-per-frame", "Scale factor between 2 frames of --frames, below 1 zooms out", cxxopts::value<float>()->default_value("1.02"))
+    ("compact", "Write quantized relative path coordinates to reduce the file size", cxxopts::value<bool>())
+    ("precision", "Number of decimals kept by --compact", cxxopts::value<int>()->default_value("1"))
+    ("batch", "Manifest file with the options of one variant per line, the tiling is computed once per level, step and form", cxxopts::value<std::string>())
+    ("cache-dir", "Directory where computed tilings are stored and reloaded", cxxopts::value<std::string>())
+    ("seed", "Seed of the flags and holes, the same seed gives the same wallpaper (default: random)", cxxopts::value<uint64_t>())
+    ("stats", "Log phase timings and counters, or write them in json with --stats=file", cxxopts::value<std::string>()->implicit_value(""))
+    ("serve", "Serve json requests, one per line, on the standard input or on the unix socket given with --serve=path", cxxopts::value<std::string>()->implicit_value(""))
+    ("serve-cache", "Number of tilings kept in memory by --serve", cxxopts::value<int>()->default_value("8"))
+    ("serve-max-level", "Highest level accepted in a --serve request", cxxopts::value<int>()->default_value("13"))
+    ("serve-max-canvas", "Largest canvas accepted in a --serve request, WIDTHxHEIGHT or a single size", cxxopts::value<std::string>()->default_value("8000"))
+    ("serve-max-connections", "Number of clients served at once on the --serve socket, others are refused", cxxopts::value<int>()->default_value("16"))
+    ("serve-max-requests", "Requests of a --serve client queued or rendered at once, the next ones are read once one is answered", cxxopts::value<int>()->default_value("8"))
     ;
   // clang-format on
   options.parse_positional({"output", "level", "step"});
-  auto clo = options.parse(argc, argv);
+  return options;
+}
 
-  if (clo.count("help")) {
-    fmt::print("{}", options.help());
-    return EXIT_SUCCESS;
+// "AxB" or "A" for "AxA", both values are positive
+std::pair<int, int> parseDimensions(const std::string &text, const std::string &option) {
+  int first = 0;
+  int second = 0;
+  const char *end = text.data() + text.size();
+  std::from_chars_result result = std::from_chars(text.data(), end, first);
+  if (result.ec == std::errc() && result.ptr == end) {
+    second = first;
+  } else if (result.ec == std::errc() && *result.ptr == 'x') {
+    result = std::from_chars(result.ptr + 1, end, second);
   }
-  if (!clo.count("output")) {
-    spdlog::error("Output filename is required");
-    fmt::print("{}", options.help());
-    return EXIT_FAILURE;
+  if (result.ec != std::errc() || result.ptr != end || first <= 0 || second <= 0) {
+    throw std::runtime_error(fmt::format("Invalid --{} value : {}, expected AxB or A", option, text));
   }
+  return {first, second};
+}
 
-  const int level = clo["level"].as<int>();
-  const int step = clo["step"].as<int>();
-  const int threshold = clo["threshold"].as<int>();
-  const bool neon = clo["neon"].as<bool>();
-  const std::string filename = clo["output"].as<std::string>();
-
-  // =================================================================================================
-  // Code
-
-  using namespace penrose;
+Variant toVariant(const cxxopts::ParseResult &clo) {
+  const auto [width, height] = parseDimensions(clo["canvas"].as<std::string>(), "canvas");
+  const auto [tileRows, tileColumns] = parseDimensions(clo["tiles"].as<std::string>(), "tiles");
+  if (tileRows > height || tileColumns > width) {
+    throw std::runtime_error(fmt::format("Cannot split a {}x{} canvas in {}x{} tiles", width, height, tileRows, tileColumns));
+  }
+  if (clo["frames"].as<int>() < 0 || !(clo["zoom-per-frame"].as<float>() > 0.f)) {
+    throw std::runtime_error("--frames must be positive and --zoom-per-frame strictly positive");
+  }
+  uint64_t seed;
+  if (clo.count("seed")) {
+    seed = clo["seed"].as<uint64_t>();
+  } else {
+    std::random_device rd;
+    seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  GeometryKey key = {clo["level"].as<int>(), clo["step"].as<int>(), clo["rhombus"].as<bool>(), clo["exact"].as<bool>(), clo["packed"].as<bool>(), clo["whole-tiles"].as<bool>(), {width, height}};
+  if (key.level < 0 || key.step < 0) {
+    throw std::runtime_error(fmt::format("--level and --step cannot be negative : {} and {}", key.level, key.step));
+  }
+  // options ignored by computeGeometry are cleared, so the same tiling always has the same key and cache file
+  if (key.packed && (key.step != 0 || key.exact)) {
+    spdlog::warn("--packed is ignored with {}", key.exact ? "--exact" : "--step, both steps always come from a single packed deflation");
+    key.packed = false;
+  }
+  if (key.wholeTiles && (key.step != 0 || key.exact || key.packed)) {
+    spdlog::warn("--whole-tiles is ignored with {}", key.step != 0 ? "--step" : key.exact ? "--exact" : "--packed");
+    key.wholeTiles = false;
+  }
+  return {
+      key,
+      clo["output"].as<std::string>(),
+      clo["threshold"].as<int>(),
+      clo["neon"].as<bool>(),
+      clo["stream"].as<bool>(),
+      clo["compact"].as<bool>(),
+      clo["precision"].as<int>(),
+      seed,
+      tileRows,
+      tileColumns,
+      clo["frames"].as<int>(),
+      clo["zoom-per-frame"].as<float>()};
+}
 
-  auto start_temp = std::chrono::high_resolution_clock::now();
+// Variants of the manifest, one per line with the same options than the command line.
+// Empty lines and lines starting with # are ignored.
+std::vector<Variant> readManifest(const std::string &filename, const char *name) {
+  std::ifstream file(filename);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Cannot open manifest file : {}.", filename));
+  }
+  std::vector<Variant> variants;
+  std::string line;
+  for (size_t lineNumber = 1; std::getline(file, line); ++lineNumber) {
+    std::istringstream stream(line);
+    std::vector<std::string> tokens = {name};
+    for (std::string token; stream >> token;) {
+      tokens.push_back(token);
+    }
+    if (tokens.size() == 1 || tokens[1].starts_with("#")) {
+      continue;
+    }
+    std::vector<char *> args;
+    for (auto &token : tokens) {
+      args.push_back(token.data());
+    }
+    int argc = static_cast<int>(args.size());
+    char **argv = args.data();
+    cxxopts::Options options = makeOptions(name);
+    auto clo = options.parse(argc, argv);
+    if (!clo.count("output")) {
+      throw std::runtime_error(fmt::format("Output filename is required line {} of {}", lineNumber, filename));
+    }
+    variants.push_back(toVariant(clo));
+  }
+  return variants;
+}
 
+struct InitialTiling {
   std::vector<PenroseTriangle> tiling;
+  // same tiling with exact coordinates
+  std::vector<ExactTriangle> exactTiling;
+};
 
-  const int canvasSize = 2000;
-  const float radius = canvasSize * 0.8f;
-  const Point center = canvasSize / 2.f * Point(1, 1);
-  // Tiling initialisation
-  if (clo.count("rhombus")) {
-    for (int i = 0, sign = -1; i < 10; ++i, sign *= -1) {
-      const float phi1 = (2 * i - sign) * pi / 10;
-      const float phi2 = (2 * i + sign) * pi / 10;
-
-      tiling.emplace_back(
+InitialTiling initialTiling(bool rhombus, const Canvas &canvas) {
+  InitialTiling initial;
+  initial.tiling = initialPatch(rhombus, canvas);
+  const ExactPoint exactCenter = {{0, 0, 0, 0}};
+  for (int i = 0, sign = -1; i < 10; ++i, sign *= -1) {
+    if (rhombus) {
+      initial.exactTiling.emplace_back(
           TriangleKind::kRhombsCyan,
-          Point(0, 0) + center,
-          radius * Point(cos(phi1), sin(phi1)) + center,
-          radius * Point(cos(phi2), sin(phi2)) + center);
+          exactCenter,
+          unitRoot((2 * i - sign - 1) / 2),
+          unitRoot((2 * i + sign - 1) / 2));
+    } else {
+      initial.exactTiling.emplace_back(
+          TriangleKind::kDart,
+          unitRoot((2 * i - sign - 1) / 2),
+          exactCenter,
+          unitRoot((2 * i + sign - 1) / 2));
     }
-  } else {
-    for (int i = 0, sign = -1; i < 10; ++i, sign *= -1) {
-      const float phi1 = (2 * i - sign) * pi / 10;
-      const float phi2 = (2 * i + sign) * pi / 10;
+  }
+  return initial;
+}
 
-      tiling.emplace_back(
-          TriangleKind::kDart,
-          radius * Point(cos(phi1), sin(phi1)) + center,
-          Point(0, 0) + center,
-          radius * Point(cos(phi2), sin(phi2)) + center);
+Geometry computeGeometry(const GeometryKey &key, int threads, const std::optional<std::filesystem::path> &cacheDir) {
+  const cache::Key cacheKey = {key.rhombus, key.exact, key.packed, key.wholeTiles, key.level, key.step, key.canvas.width, key.canvas.height};
+  Geometry geometry;
+  const stats::Timer timer("geometry");
+  if (cacheDir && isPacked(key)) {
+    if (std::optional<cache::Tiling<PackedTriangle>> cached = cache::load<PackedTriangle>(*cacheDir, cacheKey)) {
+      geometry.setPacked(cached->tiles, cached->coarse, cached->levels);
+      geometry.parent = cached->parent;
+      geometry.cacheFile = std::move(cached->file);
+      return geometry;
+    }
+  } else if (cacheDir) {
+    if (std::optional<cache::Tiling<PenroseQuadrilateral>> cached = cache::load(*cacheDir, cacheKey)) {
+      geometry.tiles = cached->tiles;
+      geometry.coarse = cached->coarse;
+      geometry.parent = cached->parent;
+      geometry.cacheFile = std::move(cached->file);
+      return geometry;
     }
   }
 
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<> distrib(0, 10);
+  const auto [tiling, exactTiling] = initialTiling(key.rhombus, key.canvas);
+  const Rectangle viewport = ::viewport(key.canvas);
+  const Frame frame = exactFrame(key.canvas);
+  if (key.step != 0) {
+    if (key.exact) {
+      std::vector<ExactQuadrilateral> exactStep1 = deflateAndMerge(exactTiling, key.step, frame, viewport);
+      geometry.computedCoarse = toFloat(exactStep1, frame);
+      geometry.computedTiles = toFloat(deflateAndMerge(splitShape(exactStep1), key.level - key.step, frame, viewport), frame);
+      geometry.computedParent = findParents(geometry.computedTiles, geometry.computedCoarse);
+    } else {
+      // both steps come from the same deflation, each tile knows its parent
+      const auto [coarseLevel, fineLevel] = stepLevels(key.level, key.step);
+      PackedHierarchy hierarchy = deflateHierarchy(pack(tiling), {coarseLevel, fineLevel}, threads, viewport);
+      geometry.computedPackedCoarse = std::move(hierarchy.tiles[0]);
+      geometry.computedPackedTiles = std::move(hierarchy.tiles[1]);
+      geometry.computedParent = std::move(hierarchy.parents[1]);
+      geometry.packedLevels = {hierarchy.frame, hierarchy.levels[1], hierarchy.levels[0]};
+    }
+  } else {
+    if (key.exact) {
+      geometry.computedTiles = toFloat(deflateAndMerge(exactTiling, key.level, frame, viewport), frame);
+    } else if (key.packed) {
+      PackedTiling merged = deflateAndMerge(pack(tiling), key.level, threads, viewport);
+      geometry.computedPackedTiles = std::move(merged.triangles);
+      geometry.packedLevels = {merged.frame, merged.level, merged.level};
+    } else if (key.wholeTiles) {
+      geometry.computedTiles = deflateTiles(tiling, key.level, threads, viewport);
+    } else {
+      geometry.computedTiles = deflateAndMerge(tiling, key.level, threads, viewport);
+    }
+  }
+  geometry.tiles = geometry.computedTiles;
+  geometry.coarse = geometry.computedCoarse;
+  geometry.parent = geometry.computedParent;
+  if (isPacked(key)) {
+    geometry.setPacked(geometry.computedPackedTiles, geometry.computedPackedCoarse, geometry.packedLevels);
+  }
 
-  svg::Document doc(canvasSize, svg::RGB{6, 12, 34});
+  if (cacheDir && isPacked(key)) {
+    cache::store(*cacheDir, cacheKey, geometry.packedTiles, geometry.packedCoarse, geometry.parent, geometry.packedLevels);
+  } else if (cacheDir) {
+    cache::store(*cacheDir, cacheKey, geometry.tiles, geometry.coarse, geometry.parent);
+  }
+  return geometry;
+}
 
-  using Style = std::pair<std::optional<svg::Fill>, std::optional<svg::StrokesStyle>>;
+// Depth first generation, tiles are drawn as soon as they are produced. Only the subtrees
+// overlapping view are deflated.
+template <typename Document>
+void drawStream(Document &doc, const Variant &variant, const Rectangle &view) {
+  using svg::Style;
+  const auto [level, step, rhombus, exact, packed, wholeTiles, canvas] = variant.key;
+  const int threshold = variant.threshold;
+  const bool neon = variant.neon;
+  std::vector<PenroseTriangle> tiling = initialTiling(rhombus, canvas).tiling;
+  // tiles are not produced in a fixed order, their random draws are keyed by position
+  const rng::Generator flags(variant.seed, flagStream);
+  const rng::Generator holes(variant.seed, holeStream);
+  auto aboveThreshold = [&](const PenroseQuadrilateral &quad) {
+    return isAboveThreshold(holes, quad.center(), threshold);
+  };
 
   if (step != 0) {
-    std::vector<PenroseQuadrilateral> quadTilingStep1 = deflateAndMerge(tiling, step);
-    setRandomFlag(quadTilingStep1, 5);
-    tiling = splitShape(quadTilingStep1);
+    const auto [coarseLevel, fineLevel] = stepLevels(level, step);
+    const PenroseQuadrilateral coarseTile = firstTile(tiling, coarseLevel);
+    PenroseQuadrilateral fineTile = firstTile(tiling, fineLevel);
 
-    std::vector<PenroseQuadrilateral> quadTilingStep2 = deflateAndMerge(tiling, level - step);
+    Style style1 = {{{26, 78, 196}}, {}};
+    Style style2 = {{{16, 48, 120}}, {}};
+    Style style3 = {{{20, 145, 239}}, {}};
+    Style style4 = {{{13, 98, 162}}, {}};
+    Style style5 = {{}, {}};
+    const float strokesWidthStep2 = norm(fineTile.vertices[0] - fineTile.vertices[1]) / 15.0f;
+    Style style6 = {{}, {{{0, 0, 0}, strokesWidthStep2}}};
+    const float strokesWidthStep1 = norm(coarseTile.vertices[0] - coarseTile.vertices[1]) / 20.0f;
+    Style style7 = {{}, {{{0, 0, 0}, strokesWidthStep1}}};
+
+    const float margin = std::max(3.f, norm(fineTile.vertices[0] - fineTile.vertices[1]) / 30.0f);
+    if (neon) {
+      fineTile = addMargin(fineTile, margin);
+      const float strokesWidth = norm(fineTile.vertices[0] - fineTile.vertices[1]) / 30.0f;
+
+      style1 = {{}, {{{175, 231, 245}, strokesWidth}}};
+      style2 = {{}, {{{39, 100, 180}, strokesWidth}}};
+      style3 = {{}, {{{119, 236, 246}, strokesWidth}}};
+      style4 = {{}, {{{175, 231, 245}, strokesWidth}}};
+      style5 = {{}, {{{16, 48, 120}, strokesWidth}}};
+      style6 = {{}, {}};
+      style7 = {{}, {}};
+    }
+
+    const size_t layer1 = doc.addLayer(style1.first, style1.second);
+    const size_t layer2 = doc.addLayer(style2.first, style2.second);
+    const size_t layer3 = doc.addLayer(style3.first, style3.second);
+    const size_t layer4 = doc.addLayer(style4.first, style4.second);
+    const size_t layer5 = doc.addLayer(style5.first, style5.second);
+    const size_t layer6 = doc.addLayer(style6.first, style6.second);
+    const size_t layer7 = doc.addLayer(style7.first, style7.second);
+
+    // the 2 halves of a coarse tile are visited separately, their flag is drawn from their common center
+    const std::vector<Segment> border = patchBorder(tiling);
+    auto visitor = [&](PenroseTriangle &triangle, int depth) {
+      if (depth == coarseLevel) {
+        const PenroseQuadrilateral coarse = completeShape(triangle);
+        triangle.flag = flags.uniform(tileCounter(coarse), 11) >= 5 ? triangle.flag : !triangle.flag;
+        if (isTileOwner(triangle, border)) {
+          doc.addToLayer(layer7, coarse);
+        }
+      }
+      return true;
+    };
+    forEachTile(tiling, fineLevel, visitor, [&](PenroseQuadrilateral quad) {
+      const bool isHole = aboveThreshold(quad);
+      if (neon) {
+        quad = addMargin(quad, margin);
+      }
+      if (isHole) {
+        doc.addToLayer(layer5, quad);
+      } else if (isSmall(quad.color)) {
+        doc.addToLayer(quad.flag ? layer1 : layer3, quad);
+      } else {
+        doc.addToLayer(quad.flag ? layer2 : layer4, quad);
+      }
+      doc.addToLayer(layer6, quad);
+    }, view);
+
+  } else {
+    const int streamLevel = deflatedLevel(variant.key);
+    const SingleLevelLayers layers = addSingleLevelLayers(doc, firstTile(tiling, streamLevel), neon);
+    forEachTile(tiling, streamLevel, VisitAll{}, [&](const PenroseQuadrilateral &quad) {
+      layers.add(doc, quad, aboveThreshold(quad));
+    }, view);
+  }
+}
+
+// Stroke of tiles, each edge shared by 2 tiles is drawn once. The edges are chained unless they are given.
+template <typename Document, typename Tiles>
+void addEdges(Document &doc, const Tiles &tiles, const svg::Style &style, const std::optional<Edges> &chained = {}) {
+  if (!style.second) {
+    return;
+  }
+  if (chained) {
+    doc.addPolygon(chained->polylines, style.first, style.second);
+    return;
+  }
+  const Edges edges = chainEdges(tiles);
+  doc.addPolygon(edges.polylines, style.first, style.second);
+}
+
+// Tiles with a margin, computed while they are read
+template <typename Tiles>
+auto withMargin(const Tiles &tiles, float margin) {
+  return tiles | std::views::transform([margin](const PenroseQuadrilateral &quad) {
+    return addMargin(quad, margin);
+  });
+}
+
+// Styling, holes and margin of a variant, tiles and coarse are the quadrilaterals of geometry
+template <typename Document, typename Tiles, typename Coarse>
+void drawTiles(Document &doc, const Variant &variant, const Geometry &geometry, const Tiles &tiles, const Coarse &coarse, int threads) {
+  using svg::Style;
+  const int threshold = variant.threshold;
+  const bool neon = variant.neon;
+  // random draws are keyed by tile center like drawStream, they are computed in bulk before styling
+  std::vector<uint8_t> aboveThreshold(std::ranges::size(tiles));
+  rng::drawAtLeast(rng::Generator(variant.seed, holeStream), 11, static_cast<uint32_t>(std::max(threshold, 0)), aboveThreshold, [&](size_t idx) {
+    return tileCounter(tiles[idx]);
+  }, threads);
+  const PenroseQuadrilateral firstTile = tiles[0];
+
+  if (variant.key.step != 0) {
+    std::vector<PenroseQuadrilateral> quadTilingStep1;
+    quadTilingStep1.reserve(std::ranges::size(coarse));
+    std::ranges::copy(coarse, std::back_inserter(quadTilingStep1));
+    setRandomFlag(quadTilingStep1, rng::Generator(variant.seed, flagStream), 5);
 
     Style style1 = {{{26, 78, 196}}, {}};
     Style style2 = {{{16, 48, 120}}, {}};
     Style style3 = {{{20, 145, 239}}, {}};
     Style style4 = {{{13, 98, 162}}, {}};
     Style style5 = {{}, {}};
-    const float strokesWidthStep2 = norm(quadTilingStep2[0].vertices[0] - quadTilingStep2[0].vertices[1]) / 15.0f;
+    const float strokesWidthStep2 = norm(firstTile.vertices[0] - firstTile.vertices[1]) / 15.0f;
     Style style6 = {{}, {{{0, 0, 0}, strokesWidthStep2}}};
     const float strokesWidthStep1 = norm(quadTilingStep1[0].vertices[0] - quadTilingStep1[0].vertices[1]) / 20.0f;
     Style style7 = {{}, {{{0, 0, 0}, strokesWidthStep1}}};
 
+    const float margin = std::max(3.f, norm(firstTile.vertices[0] - firstTile.vertices[1]) / 30.0f);
     if (neon) {
-      const float margin = std::max(3.f, norm(quadTilingStep2[0].vertices[0] - quadTilingStep2[0].vertices[1]) / 30.0f);
-
-      quadTilingStep2 = addMargin(quadTilingStep2, margin);
-      const float strokesWidth = norm(quadTilingStep2[0].vertices[0] - quadTilingStep2[0].vertices[1]) / 30.0f;
+      const PenroseQuadrilateral margined = addMargin(firstTile, margin);
+      const float strokesWidth = norm(margined.vertices[0] - margined.vertices[1]) / 30.0f;
 
       style1 = {{}, {{{175, 231, 245}, strokesWidth}}};
       style2 = {{}, {{{39, 100, 180}, strokesWidth}}};
@@ -139,63 +551,524 @@ int main(int argc, char *argv[]) try {
       style7 = {{}, {}};
     }
 
-    std::vector<IsHole> isHole(quadTilingStep2.size());
-    for (auto& tag : isHole)
-    {
-      tag = distrib(gen) >= threshold ? IsHole::Yes : IsHole::No;
-    }
-
-    doc.addPolygon(quadTilingStep2, style1.first, style1.second, [&](const auto &tr, size_t idx) {
-                      return isSmall(tr.color) && tr.flag && isHole[idx] == IsHole::No;
-                    });
-    doc.addPolygon(quadTilingStep2, style2.first, style2.second, [&](const auto &tr, size_t idx) {
-                      return !isSmall(tr.color) && tr.flag && isHole[idx] == IsHole::No;
-                    });
-    doc.addPolygon(quadTilingStep2, style3.first, style3.second, [&](const auto &tr, size_t idx) {
-                      return isSmall(tr.color) && !tr.flag && isHole[idx] == IsHole::No;
-                    });
-    doc.addPolygon(quadTilingStep2, style4.first, style4.second, [&](const auto &tr, size_t idx) {
-                      return !isSmall(tr.color) && !tr.flag && isHole[idx] == IsHole::No;
-                    });
-    doc.addPolygon(quadTilingStep2, style5.first, style5.second, [&](const auto &tr, size_t idx) {
-                      return isHole[idx] == IsHole::Yes;
-                    });
-    doc.addPolygon(quadTilingStep2, style6.first, style6.second);
-    doc.addPolygon(quadTilingStep1, style7.first, style7.second);
+    auto draw = [&](const auto &quadTilingStep2) {
+      // one pass over the tiles: fill style depends on size and flag of the parent tile, holes have no fill
+      doc.addPolygons(quadTilingStep2, {style1, style2, style3, style4, style5}, [&](const auto &tr, size_t idx) {
+        if (aboveThreshold[idx]) {
+          return 1u << 4;
+        }
+        const bool flag = quadTilingStep1[geometry.parent[idx]].flag;
+        return 1u << ((isSmall(tr.color) ? 0 : 1) + (flag ? 0 : 2));
+      });
+      // all tiles get strokes
+      addEdges(doc, quadTilingStep2, style6, neon ? std::nullopt : geometry.tileEdges);
+      addEdges(doc, quadTilingStep1, style7, geometry.coarseEdges);
+    };
+    if (neon) {
+      draw(withMargin(tiles, margin));
+    } else {
+      draw(tiles);
+    }
 
   } else {
-    std::vector<PenroseQuadrilateral> quadTiling = deflateAndMerge(tiling, level);
-
-    const float strokesWidth = std::sqrt(normSq(quadTiling[0].vertices[0]-quadTiling[0].vertices[1])) / 30.0f;
+    const float strokesWidth = std::sqrt(normSq(firstTile.vertices[0] - firstTile.vertices[1])) / 30.0f;
     Style style1 = {{{140, 140, 140}}, {}};
     Style style2 = {{{70, 70, 70}}, {}};
     Style style3 = {{}, {{{0, 0, 0}, strokesWidth}}};
 
+    const float margin = std::max(3.f, norm(firstTile.vertices[0] - firstTile.vertices[1]) / 15.0f);
     if (neon) {
-      const float margin = std::max(3.f, norm(quadTiling[0].vertices[0] - quadTiling[0].vertices[1]) / 15.0f);
-      quadTiling = addMargin(quadTiling, margin);
-
-      const float strokesWidthMargin = std::sqrt(normSq(quadTiling[0].vertices[0]-quadTiling[0].vertices[1])) / 45.0f;
+      const PenroseQuadrilateral margined = addMargin(firstTile, margin);
+      const float strokesWidthMargin = std::sqrt(normSq(margined.vertices[0] - margined.vertices[1])) / 45.0f;
       style1 = {{}, {{style1.first->color, strokesWidthMargin}}};
       style2 = {{}, {{style2.first->color, strokesWidthMargin}}};
       style3 = {{}, {}};
     }
 
-    doc.addPolygon(quadTiling, style1.first, style1.second, [&](const auto &tr, size_t idx) {
-                      return !isSmall(tr.color) && distrib(gen) >= threshold;
-                    });
-    doc.addPolygon(quadTiling, style2.first, style2.second, [&](const auto &tr, size_t idx) {
-                      return isSmall(tr.color) && distrib(gen) >= threshold;
-                    });
-    doc.addPolygon(quadTiling, style3.first, style3.second);
+    auto draw = [&](const auto &quadTiling) {
+      doc.addPolygons(quadTiling, {style1, style2}, [&](const auto &tr, size_t idx) {
+        return aboveThreshold[idx] ? 1u << (isSmall(tr.color) ? 1 : 0) : 0u;
+      });
+      addEdges(doc, quadTiling, style3, neon ? std::nullopt : geometry.tileEdges);
+    };
+    if (neon) {
+      draw(withMargin(tiles, margin));
+    } else {
+      draw(tiles);
+    }
+  }
+}
+
+// Styling, holes and margin of a variant, the shared geometry is not modified
+template <typename Document>
+void drawTiling(Document &doc, const Variant &variant, const Geometry &geometry, int threads) {
+  geometry.visit([&](const auto &tiles, const auto &coarse) {
+    drawTiles(doc, variant, geometry, tiles, coarse, threads);
+  });
+}
+
+// One frame of a zoom animation, styled like the single level stream
+template <typename Document>
+void drawZoomFrame(Document &doc, const Variant &variant, const ZoomCycle &cycle, const PenroseQuadrilateral &firstTile, double zoom, const Rectangle &view) {
+  // tiles of the frame are 1 to goldenRatio times larger than at zoom 1
+  const ZoomFrame frame = zoomFrame(zoom);
+  const float tileScale = frame.scale / std::pow(goldenRatio, static_cast<float>(frame.phase));
+  PenroseQuadrilateral first = firstTile;
+  for (auto &vertex : first.vertices) {
+    vertex = tileScale * vertex;
+  }
+  const SingleLevelLayers layers = addSingleLevelLayers(doc, first, variant.neon);
+  // holes are keyed by the position in the cycle so they stay in place between frames
+  const rng::Generator holes(variant.seed, holeStream);
+  forEachZoomTile(cycle, zoom, view, [&](const PenroseQuadrilateral &quad, const Point &key) {
+    layers.add(doc, quad, isAboveThreshold(holes, key, variant.threshold));
+  });
+}
+
+// Call function(doc) with the svg document or the rasterizer showing view, depending on the extension of filename
+template <typename Function>
+auto withDocument(const Variant &variant, const std::string &filename, const Rectangle &view, int threads, Function &&function) {
+  const std::string extension = std::filesystem::path(filename).extension().string();
+  if (extension == ".png" || extension == ".ppm") {
+    raster::Document doc(view, background, threads);
+    return function(doc);
+  }
+  svg::Document doc(view, background, variant.compact ? std::optional<int>(std::clamp(variant.precision, 0, 6)) : std::nullopt);
+  return function(doc);
+}
+
+// Draw the view part of a variant to filename with draw(doc)
+template <typename Draw>
+bool renderView(const Variant &variant, const std::string &filename, const Rectangle &view, int threads, Draw &&draw) {
+  return withDocument(variant, filename, view, threads, [&](auto &doc) {
+    if (!doc.open(filename)) {
+      return false;
+    }
+    draw(doc);
+    return doc.save(filename);
+  });
+}
+
+std::string contentOf(svg::Document &doc, const std::string &) {
+  return doc.getContent();
+}
+
+std::string contentOf(raster::Document &doc, const std::string &filename) {
+  const std::vector<uint8_t> content = doc.getContent(std::filesystem::path(filename).extension() == ".ppm");
+  return std::string(content.begin(), content.end());
+}
+
+// Part of a tiled output, in canvas pixels
+struct ScreenTile {
+  int row;
+  int column;
+  int x;
+  int y;
+  int width;
+  int height;
+  std::filesystem::path path;
+};
+
+// Screen tiles row by row, output.svg gives output-r0-c0.svg, output-r0-c1.svg, ...
+std::vector<ScreenTile> screenTiles(const Variant &variant) {
+  const Canvas &canvas = variant.key.canvas;
+  const std::filesystem::path output(variant.filename);
+  std::vector<ScreenTile> tiles;
+  for (int row = 0; row < variant.tileRows; ++row) {
+    const int y0 = canvas.height * row / variant.tileRows;
+    const int y1 = canvas.height * (row + 1) / variant.tileRows;
+    for (int column = 0; column < variant.tileColumns; ++column) {
+      const int x0 = canvas.width * column / variant.tileColumns;
+      const int x1 = canvas.width * (column + 1) / variant.tileColumns;
+      std::filesystem::path path = output;
+      path.replace_filename(fmt::format("{}-r{}-c{}{}", output.stem().string(), row, column, output.extension().string()));
+      tiles.push_back({row, column, x0, y0, x1 - x0, y1 - y0, path});
+    }
+  }
+  return tiles;
+}
+
+// Index of a tiled output, file names are relative to the index
+bool writeTileIndex(const Variant &variant, const std::vector<ScreenTile> &tiles) {
+  std::filesystem::path path(variant.filename);
+  path.replace_extension(".json");
+  fmt::memory_buffer out;
+  fmt::format_to(std::back_inserter(out), "{{\n  \"width\": {},\n  \"height\": {},\n  \"rows\": {},\n  \"columns\": {},\n  \"seed\": {},\n  \"tiles\": [",
+                 variant.key.canvas.width, variant.key.canvas.height, variant.tileRows, variant.tileColumns, variant.seed);
+  const char *separator = "";
+  for (const ScreenTile &tile : tiles) {
+    fmt::format_to(std::back_inserter(out), "{}\n    {{\"file\": \"{}\", \"row\": {}, \"column\": {}, \"x\": {}, \"y\": {}, \"width\": {}, \"height\": {}}}",
+                   separator, tile.path.filename().string(), tile.row, tile.column, tile.x, tile.y, tile.width, tile.height);
+    separator = ",";
+  }
+  fmt::format_to(std::back_inserter(out), "\n  ]\n}}\n");
+  std::ofstream file(path, std::ios::binary);
+  if (!file || !file.write(out.data(), static_cast<std::streamsize>(out.size()))) {
+    spdlog::error("Cannot write output file : {}.", path.string());
+    return false;
+  }
+  return true;
+}
+
+// Screen tiles are independent: each one is generated depth first with its own view as clip and
+// written to its own file, so the memory used by a tile does not depend on the canvas size.
+// Random draws are keyed by position, tiles agree along their common borders.
+bool renderTiles(const Variant &variant, int threads) {
+  const std::vector<ScreenTile> tiles = screenTiles(variant);
+  std::atomic<size_t> failures = 0;
+  parallel::forEach(tiles.size(), threads, [&](size_t idx) {
+    const ScreenTile &tile = tiles[idx];
+    const Rectangle view(Point(tile.x, tile.y), Point(tile.x + tile.width, tile.y + tile.height));
+    if (!renderView(variant, tile.path.string(), view, 1, [&](auto &doc) { drawStream(doc, variant, view); })) {
+      ++failures;
+    }
+  });
+  return writeTileIndex(variant, tiles) && failures == 0;
+}
+
+// Frames are independent once the tiles of the zoom cycle are known, they are rendered in parallel and
+// the cost of a frame does not depend on the zoom
+bool renderFrames(const Variant &variant, int threads) {
+  const Canvas &canvas = variant.key.canvas;
+  const int level = std::max(variant.key.level, 1);
+  const std::vector<PenroseTriangle> tiling = initialTiling(variant.key.rhombus, canvas).tiling;
+  const Rectangle view = viewport(canvas);
+  const ZoomCycle cycle = zoomCycle(tiling, level, patchCenter(canvas), view);
+  const PenroseQuadrilateral first = firstTile(tiling, level);
+
+  const std::filesystem::path output(variant.filename);
+  const int digits = std::max(4, static_cast<int>(fmt::format("{}", variant.frames - 1).size()));
+  std::atomic<size_t> failures = 0;
+  parallel::forEach(static_cast<size_t>(variant.frames), threads, [&](size_t frame) {
+    std::filesystem::path path = output;
+    path.replace_filename(fmt::format("{}-{:0{}}{}", output.stem().string(), frame, digits, output.extension().string()));
+    const double zoom = std::pow(static_cast<double>(variant.zoomPerFrame), static_cast<double>(frame));
+    if (!renderView(variant, path.string(), view, 1, [&](auto &doc) { drawZoomFrame(doc, variant, cycle, first, zoom, view); })) {
+      ++failures;
+    }
+  });
+  return failures == 0;
+}
+
+// Variants drawn depth first do not need the whole geometry
+bool needsGeometry(const Variant &variant) {
+  return !variant.stream && !variant.tiled() && variant.frames == 0;
+}
+
+// Draw a variant in the svg document or the rasterizer depending on the output extension
+bool render(const Variant &variant, const Geometry *geometry, int threads) {
+  spdlog::info("{} : seed {}", variant.filename, variant.seed);
+  if (variant.frames != 0) {
+    return renderFrames(variant, threads);
+  }
+  if (variant.tiled()) {
+    return renderTiles(variant, threads);
+  }
+  const Rectangle view = viewport(variant.key.canvas);
+  return renderView(variant, variant.filename, view, threads, [&](auto &doc) {
+    if (needsGeometry(variant)) {
+      drawTiling(doc, variant, *geometry, threads);
+    } else {
+      drawStream(doc, variant, view);
+    }
+  });
+}
+
+// =================================================================================================
+// Server
+
+// Options a request cannot change, they concern files or the server itself
+bool isServerOption(const std::string &name) {
+  static const std::vector<std::string> names = {"help", "output", "batch", "cache-dir", "stats", "threads", "tiles", "frames", "zoom-per-frame", "serve", "serve-cache", "serve-max-level", "serve-max-canvas", "serve-max-connections", "serve-max-requests"};
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+// Variant of a request, the json fields are given to the command line parser. The output format is
+// given by the "format" field.
+Variant toVariant(const std::vector<server::Field> &fields, const char *name, std::string &id, std::string &format) {
+  std::vector<std::string> tokens = {name};
+  for (const auto &field : fields) {
+    if (field.name == "id") {
+      id = field.value;
+    } else if (field.name == "format") {
+      format = field.value;
+    } else if (isServerOption(field.name)) {
+      throw std::runtime_error(fmt::format("Option {} is not accepted in a request", field.name));
+    } else if (!field.isString && field.value == "true") {
+      tokens.push_back("--" + field.name);
+    } else if (field.isString || (field.value != "false" && field.value != "null")) {
+      tokens.push_back(fmt::format("--{}={}", field.name, field.value));
+    }
+  }
+  if (format != "svg" && format != "png" && format != "ppm") {
+    throw std::runtime_error(fmt::format("Unknown format : {}, expected svg, png or ppm", format));
+  }
+  tokens.push_back("--output=request." + format);
+
+  std::vector<char *> args;
+  for (auto &token : tokens) {
+    args.push_back(token.data());
+  }
+  int argc = static_cast<int>(args.size());
+  char **argv = args.data();
+  cxxopts::Options options = makeOptions(name);
+  return toVariant(options.parse(argc, argv));
+}
+
+// Limits of the requests and of the clients accepted by the server
+struct ServerLimits {
+  int level;
+  Canvas canvas;
+  int connections;
+  int requests;
+};
+
+void checkLimits(const Variant &variant, const ServerLimits &limits) {
+  // with --step the deepest level may be above the requested one
+  const int level = deflatedLevel(variant.key);
+  if (level > limits.level) {
+    throw std::runtime_error(fmt::format("Level {} is above the server maximum : {}", level, limits.level));
+  }
+  if (variant.key.canvas.width > limits.canvas.width || variant.key.canvas.height > limits.canvas.height) {
+    throw std::runtime_error(fmt::format("Canvas {}x{} is above the server maximum : {}x{}", variant.key.canvas.width, variant.key.canvas.height, limits.canvas.width, limits.canvas.height));
+  }
+}
+
+// Geometry kept by the server, its edges are chained once for all the requests
+Geometry serverGeometry(const GeometryKey &key, const std::optional<std::filesystem::path> &cacheDir) {
+  Geometry geometry = computeGeometry(key, 1, cacheDir);
+  std::optional<Edges> tileEdges;
+  std::optional<Edges> coarseEdges;
+  geometry.visit([&](const auto &tiles, const auto &coarse) {
+    tileEdges = chainEdges(tiles);
+    if (!coarse.empty()) {
+      coarseEdges = chainEdges(coarse);
+    }
+  });
+  geometry.tileEdges = std::move(tileEdges);
+  geometry.coarseEdges = std::move(coarseEdges);
+  return geometry;
+}
+
+using GeometryCache = cache::LruCache<GeometryKey, Geometry>;
+
+void respond(server::Connection &connection, const std::string &request, GeometryCache &geometries, const ServerLimits &limits, const std::optional<std::filesystem::path> &cacheDir, const char *name) {
+  const auto start = std::chrono::steady_clock::now();
+  std::string id;
+  std::string format = "svg";
+  std::string header;
+  std::string content;
+  try {
+    const Variant variant = toVariant(server::parseObject(request), name, id, format);
+    checkLimits(variant, limits);
+    std::shared_ptr<const Geometry> geometry;
+    if (needsGeometry(variant)) {
+      geometry = geometries.get(variant.key, [&] {
+        return serverGeometry(variant.key, cacheDir);
+      });
+    }
+    const Rectangle view = viewport(variant.key.canvas);
+    content = withDocument(variant, variant.filename, view, 1, [&](auto &doc) {
+      if (geometry) {
+        drawTiling(doc, variant, *geometry, 1);
+      } else {
+        drawStream(doc, variant, view);
+      }
+      return contentOf(doc, variant.filename);
+    });
+    header = fmt::format("{{\"id\": {}, \"status\": \"ok\", \"format\": {}, \"seed\": {}, \"bytes\": {}}}\n", server::quote(id), server::quote(format), variant.seed, content.size());
+  } catch (const std::exception &e) {
+    content.clear();
+    header = fmt::format("{{\"id\": {}, \"status\": \"error\", \"message\": {}, \"bytes\": 0}}\n", server::quote(id), server::quote(e.what()));
+  }
+  if (!connection.send(header, content)) {
+    spdlog::warn("Request {} : the client closed the connection", id);
+  }
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  spdlog::debug("Request {} : {} bytes in {:.2f} ms", id, content.size(), elapsed.count());
+}
+
+// State of the server shared by the readers of the connections, they may outlive serve
+struct ServerState {
+  ServerState(int threads, int cacheSize, const ServerLimits &limits, const std::optional<std::filesystem::path> &cacheDir, const char *name)
+      : geometries(static_cast<size_t>(std::max(cacheSize, 1))), limits(limits), cacheDir(cacheDir), name(name), pool(threads) {
+  }
+
+  GeometryCache geometries;
+  const ServerLimits limits;
+  const std::optional<std::filesystem::path> cacheDir;
+  const char *name;
+  std::atomic<int> connections = 0;
+  // last member, its destructor waits for the tasks using the others
+  parallel::ThreadPool pool;
+};
 
+// Requests of a connection are read in order and served concurrently by the pool. Once limits.requests
+// of them are queued or rendered, the next line is only read when one is answered.
+void serveConnection(const std::shared_ptr<server::Connection> &connection, ServerState &state) {
+  struct Pending {
+    std::mutex mutex;
+    std::condition_variable answered;
+    int count = 0;
+  };
+  // shared with the tasks, so it outlives their last notification
+  auto pending = std::make_shared<Pending>();
+  std::string line;
+  while (connection->readLine(line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> lock(pending->mutex);
+      pending->answered.wait(lock, [&] { return pending->count < state.limits.requests; });
+      ++pending->count;
+    }
+    state.pool.submit([connection, pending, line, &state] {
+      respond(*connection, line, state.geometries, state.limits, state.cacheDir, state.name);
+      std::lock_guard<std::mutex> lock(pending->mutex);
+      --pending->count;
+      pending->answered.notify_one();
+    });
   }
+  if (connection->isLineTooLong()) {
+    spdlog::warn("Connection closed : request longer than {} bytes", server::Connection::maxLineLength);
+  }
+  // the tasks use state, they are all answered before the reader releases it
+  std::unique_lock<std::mutex> lock(pending->mutex);
+  pending->answered.wait(lock, [&] { return pending->count == 0; });
+}
 
-  doc.save(filename);
+// Serve requests on the standard input until it is closed, or on the unix socket at socketPath until the process is stopped
+void serve(const std::string &socketPath, int threads, int cacheSize, const ServerLimits &limits, const std::optional<std::filesystem::path> &cacheDir, const char *name) {
+  const auto state = std::make_shared<ServerState>(threads, cacheSize, limits, cacheDir, name);
+  if (socketPath.empty()) {
+    spdlog::info("Serving requests on the standard input");
+    serveConnection(std::make_shared<server::Connection>(), *state);
+    return;
+  }
+#if defined(_WIN32)
+  throw std::runtime_error("Unix sockets are not supported on Windows, use --serve without path");
+#else
+  const int listener = server::listenUnix(socketPath);
+  spdlog::info("Serving requests on {}", socketPath);
+  // accept fails at once until a descriptor is released when the process is out of them (EMFILE, ENFILE),
+  // the wait between attempts doubles up to 1 s instead of spinning
+  std::chrono::milliseconds backoff(0);
+  for (;;) {
+    const int client = server::acceptClient(listener);
+    if (client < 0) {
+      backoff = std::clamp(2 * backoff, std::chrono::milliseconds(10), std::chrono::milliseconds(1000));
+      spdlog::error("Cannot accept connection : {}, next attempt in {} ms", std::strerror(errno), backoff.count());
+      std::this_thread::sleep_for(backoff);
+      continue;
+    }
+    backoff = std::chrono::milliseconds(0);
+    auto connection = std::make_shared<server::Connection>(client);
+    if (state->connections.fetch_add(1) >= limits.connections) {
+      state->connections.fetch_sub(1);
+      spdlog::warn("Connection refused : {} clients are already served", limits.connections);
+      connection->send("{\"id\": null, \"status\": \"error\", \"message\": \"Too many connections\", \"bytes\": 0}\n", {});
+      continue;
+    }
+    // one reader per client, the rendering is done by the pool. Each reader keeps the state alive.
+    std::thread([connection = std::move(connection), state] {
+      serveConnection(connection, *state);
+      state->connections.fetch_sub(1);
+    }).detach();
+  }
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) try {
+
+  spdlog::cfg::load_env_levels();
+
+  // =================================================================================================
+  // CLI
+  cxxopts::Options options = makeOptions(argv[0]);
+  auto clo = options.parse(argc, argv);
+
+  if (clo.count("help")) {
+    fmt::print("{}", options.help());
+    return EXIT_SUCCESS;
+  }
+  if (clo.count("serve")) {
+    // the standard output may carry the responses, logs go to the standard error
+    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+    spdlog::cfg::load_env_levels();
+    const std::optional<std::filesystem::path> cacheDir = clo.count("cache-dir") ? std::optional<std::filesystem::path>(clo["cache-dir"].as<std::string>()) : std::nullopt;
+    const auto [maxWidth, maxHeight] = parseDimensions(clo["serve-max-canvas"].as<std::string>(), "serve-max-canvas");
+    const ServerLimits limits = {clo["serve-max-level"].as<int>(), {maxWidth, maxHeight}, std::max(clo["serve-max-connections"].as<int>(), 1), std::max(clo["serve-max-requests"].as<int>(), 1)};
+    serve(clo["serve"].as<std::string>(), clo["threads"].as<int>(), clo["serve-cache"].as<int>(), limits, cacheDir, argv[0]);
+    return EXIT_SUCCESS;
+  }
+  if (!clo.count("output") && !clo.count("batch")) {
+    spdlog::error("Output filename is required");
+    fmt::print("{}", options.help());
+    return EXIT_FAILURE;
+  }
+
+  const int threads = clo["threads"].as<int>();
+  if (clo.count("stats")) {
+    if (!stats::compiled) {
+      spdlog::warn("--stats is ignored, statistics were not compiled in (PENROSE_STATS)");
+    }
+    stats::enable();
+  }
+  const std::optional<std::filesystem::path> cacheDir = clo.count("cache-dir") ? std::optional<std::filesystem::path>(clo["cache-dir"].as<std::string>()) : std::nullopt;
+
+  // =================================================================================================
+  // Code
+
+  auto start_temp = std::chrono::high_resolution_clock::now();
+
+  if (clo.count("batch")) {
+    const std::vector<Variant> variants = readManifest(clo["batch"].as<std::string>(), argv[0]);
+
+    // variants are grouped by geometry, each geometry is computed once and rendered by all its variants in parallel
+    std::map<GeometryKey, std::vector<size_t>> groups;
+    for (size_t idx = 0; idx < variants.size(); ++idx) {
+      groups[variants[idx].key].push_back(idx);
+    }
+    std::atomic<size_t> failures = 0;
+    for (const auto &[key, members] : groups) {
+      const bool needGeometry = std::any_of(members.begin(), members.end(), [&](size_t idx) { return needsGeometry(variants[idx]); });
+      const Geometry geometry = needGeometry ? computeGeometry(key, threads, cacheDir) : Geometry{};
+      parallel::forEach(members.size(), threads, [&](size_t idx) {
+        if (!render(variants[members[idx]], &geometry, 1)) {
+          ++failures;
+        }
+      });
+    }
+    spdlog::info("{} variants rendered from {} geometries", variants.size() - failures, groups.size());
+    if (failures != 0) {
+      return EXIT_FAILURE;
+    }
+
+  } else {
+    const Variant variant = toVariant(clo);
+    const Geometry geometry = needsGeometry(variant) ? computeGeometry(variant.key, threads, cacheDir) : Geometry{};
+    if (!render(variant, &geometry, threads)) {
+      return EXIT_FAILURE;
+    }
+  }
 
   std::chrono::duration<double, std::milli> elapsed_temp = std::chrono::high_resolution_clock::now() - start_temp;
   fmt::print("Execution time: {:.2f} ms \n", elapsed_temp.count());
 
+  if (stats::enabled()) {
+    const std::string statsFile = clo["stats"].as<std::string>();
+    if (statsFile.empty()) {
+      stats::log();
+    } else if (std::ofstream out(statsFile); out) {
+      out << stats::toJson();
+    } else {
+      spdlog::error("Cannot open output file : {}.", statsFile);
+    }
+  }
+
   return EXIT_SUCCESS;
 
 } catch (const cxxopts::OptionException &e) {
@@ -0,0 +1,451 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <geometry.hpp>
+#include <parallel.hpp>
+#include <penrose.hpp>
+#include <stats.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace penrose {
+
+// Packed triangle backend
+// Edges of a Penrose tiling only have 10 directions, k pi / 5 from a reference one, and the triangles
+// of a kind and level are all the same shape or its mirror image. A triangle is stored as its first
+// vertex, its kind and its orientation : 12 bytes instead of 32 for a PenroseTriangle. Its other
+// vertices and its children are offsets of the first vertex read in a table computed once per level,
+// vertices are only rebuilt at serialization.
+constexpr size_t directionCount = 10;
+// direction of the first edge and whether the triangle is mirrored
+constexpr size_t orientationCount = 2 * directionCount;
+
+struct PackedTriangle {
+  float x;
+  float y;
+  uint8_t kind;
+  // 2 * direction + mirrored
+  uint8_t orientation;
+  bool flag;
+};
+
+static_assert(sizeof(PackedTriangle) == 12, "packed triangles are expected to take 12 bytes");
+
+inline bool isMirrored(const PackedTriangle &triangle) {
+  return triangle.orientation & 1;
+}
+
+// Placement of the tiling : direction of the first edge of orientation 0 and length of the first
+// edge of the dart or cyan rhombus at level 0
+struct PackedFrame {
+  float rotation;
+  float scale;
+};
+
+// Triangles of a kind and orientation at one level, points are relative to the first vertex
+struct PackedShape {
+  // the 3 vertices and the mirror of the first one that completes the tile
+  Quadrilateral vertices;
+  // bounding box of the triangle
+  Rectangle box;
+  // center of the completed tile
+  Point center;
+  size_t childCount;
+  // children with their first vertex relative to the parent one
+  std::array<PackedTriangle, 3> children;
+};
+
+class PackedLevel {
+public:
+  PackedLevel(const PackedFrame &frame, int level)
+      : frame(frame) {
+    const double length = frame.scale / std::pow(static_cast<double>(goldenRatio), level);
+    shapes.reserve(referenceTriangles().size() * orientationCount);
+    for (const auto &reference : referenceTriangles()) {
+      // reference with its first edge along the x axis and unmirrored
+      const Point AB = reference.vertices[1] - reference.vertices[0];
+      const Point AC = reference.vertices[2] - reference.vertices[0];
+      const double angle = std::atan2(AB.y, AB.x);
+      const double referenceMirror = AB.x * AC.y - AB.y * AC.x < 0.f ? -1. : 1.;
+      const std::array<std::array<double, 2>, 2> local = {{
+          {norm(AB), 0.},
+          {AC.x * std::cos(angle) + AC.y * std::sin(angle), referenceMirror * (AC.y * std::cos(angle) - AC.x * std::sin(angle))},
+      }};
+
+      for (size_t orientation = 0; orientation < orientationCount; ++orientation) {
+        const double rotation = frame.rotation + static_cast<double>(orientation / 2) * pi / 5;
+        const double mirror = orientation & 1 ? -1. : 1.;
+        auto place = [&](const std::array<double, 2> &pt) {
+          const double x = pt[0];
+          const double y = mirror * pt[1];
+          return Point(static_cast<float>(length * (x * std::cos(rotation) - y * std::sin(rotation))),
+                       static_cast<float>(length * (x * std::sin(rotation) + y * std::cos(rotation))));
+        };
+        const PenroseTriangle triangle(reference.color, Point(0, 0), place(local[0]), place(local[1]));
+        const PenroseQuadrilateral quad = completeShape(triangle);
+
+        PackedShape shape = {quad, boundingBox(triangle), quad.center(), 0, {}};
+        std::vector<PenroseTriangle> children;
+        deflate(triangle, std::back_inserter(children));
+        for (const auto &child : children) {
+          shape.children[shape.childCount++] = {child.vertices[0].x, child.vertices[0].y, static_cast<uint8_t>(child.color), orientationOf(child), false};
+        }
+        shapes.push_back(shape);
+      }
+    }
+  }
+
+  const PackedShape &shape(const PackedTriangle &triangle) const {
+    return shapes[triangle.kind * orientationCount + triangle.orientation];
+  }
+
+  // Orientation of a triangle of this frame, whatever its level
+  uint8_t orientationOf(const PenroseTriangle &triangle) const {
+    const Point AB = triangle.vertices[1] - triangle.vertices[0];
+    const Point AC = triangle.vertices[2] - triangle.vertices[0];
+    const double turns = (std::atan2(AB.y, AB.x) - frame.rotation) / (pi / 5);
+    const long direction = ((std::lround(turns) % 10) + 10) % 10;
+    return static_cast<uint8_t>(2 * direction + (AB.x * AC.y - AB.y * AC.x < 0.f ? 1 : 0));
+  }
+
+  Quadrilateral vertices(const PackedTriangle &triangle) const {
+    const Point anchor(triangle.x, triangle.y);
+    const auto &[A, B, C, D] = shape(triangle).vertices.vertices;
+    return {anchor + A, anchor + B, anchor + C, anchor + D};
+  }
+
+private:
+  PackedFrame frame;
+  // indexed by kind * orientationCount + orientation
+  std::vector<PackedShape> shapes;
+};
+
+struct PackedTiling {
+  PackedFrame frame;
+  // number of deflations since the packed triangles
+  int level;
+  std::vector<PackedTriangle> triangles;
+};
+
+// Pack triangles of a Penrose tiling, their frame is deduced from the first one.
+// Throw std::invalid_argument if a triangle is not on the directions and sizes of the first one.
+inline PackedTiling pack(const std::vector<PenroseTriangle> &triangles) {
+  PackedTiling tiling = {{0.f, 1.f}, 0, {}};
+  if (triangles.empty()) {
+    return tiling;
+  }
+  const PenroseTriangle &first = triangles[0];
+  const PenroseTriangle &reference = referenceTriangles()[static_cast<size_t>(first.color)];
+  const Point AB = first.vertices[1] - first.vertices[0];
+  tiling.frame = {std::atan2(AB.y, AB.x), norm(AB) / norm(reference.vertices[1] - reference.vertices[0])};
+
+  const PackedLevel table(tiling.frame, 0);
+  const float tolerance = std::sqrt(epsilon);
+  tiling.triangles.reserve(triangles.size());
+  for (const auto &triangle : triangles) {
+    const PackedTriangle packed = {triangle.vertices[0].x, triangle.vertices[0].y, static_cast<uint8_t>(triangle.color), table.orientationOf(triangle), triangle.flag};
+    const Quadrilateral placed = table.vertices(packed);
+    for (size_t v = 0; v < 3; ++v) {
+      if (norm(placed.vertices[v] - triangle.vertices[v]) > tolerance) {
+        throw std::invalid_argument("Triangle is not aligned with the first one of the tiling, it cannot be packed");
+      }
+    }
+    tiling.triangles.push_back(packed);
+  }
+  return tiling;
+}
+
+// Packed triangle with the index of the tile it belongs to in the last merged level of a PackedHierarchy
+struct TrackedTriangle {
+  PackedTriangle triangle;
+  uint32_t owner;
+};
+
+inline const PackedTriangle &packed(const PackedTriangle &triangle) {
+  return triangle;
+}
+inline PackedTriangle &packed(PackedTriangle &triangle) {
+  return triangle;
+}
+inline const PackedTriangle &packed(const TrackedTriangle &triangle) {
+  return triangle.triangle;
+}
+inline PackedTriangle &packed(TrackedTriangle &triangle) {
+  return triangle.triangle;
+}
+
+template <typename T>
+KindCount countKinds(const std::vector<T> &triangles) {
+  KindCount count = {};
+  for (const auto &triangle : triangles) {
+    ++count[packed(triangle).kind];
+  }
+  return count;
+}
+
+// Deflate triangles of table level once into output, children inherit the flag and owner of their parent.
+// Only the unmirrored children are kept with keepMirrored set to false.
+template <typename T>
+void deflate(const std::vector<T> &triangles, const PackedLevel &table, std::vector<T> &output, bool keepMirrored = true) {
+  output.clear();
+  output.reserve(total(countAfterDeflation(countKinds(triangles), 1)));
+  for (const T &parent : triangles) {
+    const PackedTriangle &triangle = packed(parent);
+    const PackedShape &shape = table.shape(triangle);
+    for (size_t c = 0; c < shape.childCount; ++c) {
+      const PackedTriangle &child = shape.children[c];
+      if (keepMirrored || !isMirrored(child)) {
+        T item = parent;
+        packed(item) = {triangle.x + child.x, triangle.y + child.y, child.kind, child.orientation, triangle.flag};
+        output.push_back(item);
+      }
+    }
+  }
+}
+
+// Remove triangles whose bounding box doesn't intersect clip.
+// Return true if all remaining triangles are inside clip, their descendants don't need to be checked anymore.
+template <typename T>
+bool cull(std::vector<T> &triangles, const PackedLevel &table, const Rectangle &clip) {
+  bool inside = true;
+  std::erase_if(triangles, [&](const T &item) {
+    const PackedTriangle &triangle = packed(item);
+    const Rectangle &box = table.shape(triangle).box;
+    const Point anchor(triangle.x, triangle.y);
+    const Rectangle placed(anchor + box.min, anchor + box.max);
+    if (!intersects(clip, placed)) {
+      return true;
+    }
+    inside = inside && contains(clip, placed);
+    return false;
+  });
+  return inside;
+}
+
+// Deflate triangles of levels[first] until levels[last], with the culling of deflate(TriangleSoA, level, clip).
+// With merge, the last deflation only keeps the unmirrored half of each tile.
+template <typename T>
+std::vector<T> deflate(std::vector<T> current, const std::vector<PackedLevel> &levels, size_t first, size_t last, const std::optional<Rectangle> &clip, bool merge, int firstLevel = 0) {
+  std::vector<T> next;
+  bool inside = !clip;
+  for (size_t l = first; l < last; ++l) {
+    if (!inside) {
+      inside = cull(current, levels[l], *clip);
+    }
+    deflate(current, levels[l], next, !merge || l + 1 < last);
+    std::swap(current, next);
+    if (stats::enabled()) {
+      stats::addTiles(firstLevel + static_cast<int>(l) + 1, countKinds(current));
+    }
+  }
+  if (!inside) {
+    cull(current, levels[last], *clip);
+  }
+  return current;
+}
+
+// Deflate triangles of levels[first] until the last level of levels and keep the unmirrored half of each tile.
+// Levels are deflated sequentially until they contain parallelMinTriangles triangles, then each chunk of
+// parallelTaskSize triangles is deflated as an independent task, like in deflateAndComplete.
+template <typename T>
+std::vector<T> deflateAndMerge(const std::vector<T> &triangles, const std::vector<PackedLevel> &levels, size_t first, int threads, const std::optional<Rectangle> &clip, int firstLevel) {
+  const size_t last = levels.size() - 1;
+  size_t splitLevel = first;
+  while (splitLevel + 1 < last && total(countAfterDeflation(countKinds(triangles), static_cast<int>(splitLevel - first))) < parallelMinTriangles) {
+    ++splitLevel;
+  }
+  const std::vector<T> coarse = deflate(triangles, levels, first, splitLevel, clip, false, firstLevel);
+
+  const size_t taskCount = (coarse.size() + parallelTaskSize - 1) / parallelTaskSize;
+  std::vector<std::vector<T>> results(taskCount);
+  parallel::forEach(taskCount, threads, [&](size_t idx) {
+    const auto begin = coarse.begin() + idx * parallelTaskSize;
+    const auto end = coarse.begin() + std::min(coarse.size(), (idx + 1) * parallelTaskSize);
+    results[idx] = deflate(std::vector<T>(begin, end), levels, splitLevel, last, clip, true, firstLevel);
+  });
+
+  size_t count = 0;
+  for (const auto &result : results) {
+    count += result.size();
+  }
+  std::vector<T> merged;
+  merged.reserve(count);
+  for (auto &result : results) {
+    merged.insert(merged.end(), result.begin(), result.end());
+    result = {};
+  }
+  return merged;
+}
+
+// Tables of the levels of tiling from tiling.level to tiling.level + level, and clip enlarged by the size of the final tiles
+inline std::pair<std::vector<PackedLevel>, std::optional<Rectangle>> prepare(const PackedTiling &tiling, int level, const std::optional<Rectangle> &clip) {
+  std::vector<PackedLevel> levels;
+  for (int l = 0; l <= level; ++l) {
+    levels.emplace_back(tiling.frame, tiling.level + l);
+  }
+  std::optional<Rectangle> area;
+  if (clip) {
+    // final tiles stick out of their triangle by less than 2 final edges, the longest edge of a triangle
+    // is at most goldenRatio times the first edge of the dart or cyan rhombus
+    area = expand(*clip, 2.f * tiling.frame.scale * goldenRatio / std::pow(goldenRatio, static_cast<float>(tiling.level + level)));
+  }
+  return {std::move(levels), area};
+}
+
+// Deflate level times and keep one triangle per tile, the one that is not mirrored. Halves whose mirror
+// is outside the initial triangles are dropped, like the ones whose mirror is outside clip.
+// Triangles of the result stand for their completed quadrilateral.
+// firstLevel is the level of the input triangles, it is only used to record tile counts.
+inline PackedTiling deflateAndMerge(const PackedTiling &tiling, int level, int threads = 1, const std::optional<Rectangle> &clip = {}, int firstLevel = 0) {
+  // at least one deflation is always done
+  level = std::max(level, 1);
+  const stats::Timer timer("packedDeflate");
+  const auto [levels, area] = prepare(tiling, level, clip);
+  PackedTiling merged = {tiling.frame, tiling.level + level, deflateAndMerge(tiling.triangles, levels, 0, threads, area, firstLevel)};
+  stats::add("tiles", merged.triangles.size());
+  spdlog::debug("deflateAndMerge: {} packed tiles", merged.triangles.size());
+  return merged;
+}
+
+// Merged tilings of several levels of the same deflation, linked by the index of their parent tile.
+// The substitution tree is only walked once : the deflation is not restarted from the merged tiles of a
+// level, and the tiles of a level are not searched in the previous one.
+struct PackedHierarchy {
+  PackedFrame frame;
+  // levels of the tilings, relative to the packed triangles
+  std::vector<int> levels;
+  // tiles of each level, each tile is represented by one of its halves, the first one deflated
+  std::vector<std::vector<PackedTriangle>> tiles;
+  // for each level but the first, index in the previous level of the tile containing the first half of each tile
+  std::vector<std::vector<uint32_t>> parents;
+
+  PackedTiling tiling(size_t level) const {
+    return {frame, levels[level], tiles[level]};
+  }
+
+  // Index of the tile at level ancestorLevel containing the tile idx of level
+  uint32_t ancestor(size_t level, uint32_t idx, size_t ancestorLevel) const {
+    for (; level > ancestorLevel; --level) {
+      idx = parents[level][idx];
+    }
+    return idx;
+  }
+
+  // Value of the ancestor at level ancestorLevel of each tile of level
+  template <typename Value>
+  std::vector<Value> inherit(size_t level, size_t ancestorLevel, std::span<const Value> values) const {
+    std::vector<Value> inherited;
+    inherited.reserve(tiles[level].size());
+    for (uint32_t idx = 0; idx < tiles[level].size(); ++idx) {
+      inherited.push_back(values[ancestor(level, idx, ancestorLevel)]);
+    }
+    return inherited;
+  }
+};
+
+// Deflate the merged tilings of levels, given in increasing order relative to tiling.
+// The tiles of intermediate levels are merged by center so a tile with a single half inside clip is kept,
+// the last level keeps the unmirrored halves like deflateAndMerge.
+inline PackedHierarchy deflateHierarchy(const PackedTiling &tiling, const std::vector<int> &levels, int threads = 1, const std::optional<Rectangle> &clip = {}, int firstLevel = 0) {
+  if (levels.empty() || levels.front() < 1 || std::adjacent_find(levels.begin(), levels.end(), std::greater_equal<>()) != levels.end()) {
+    throw std::invalid_argument("Hierarchy levels must be increasing and larger than 0");
+  }
+  const stats::Timer timer("packedDeflate");
+  const auto [tables, area] = prepare(tiling, levels.back(), clip);
+  PackedHierarchy hierarchy = {tiling.frame, {}, {}, {}};
+
+  constexpr uint32_t noOwner = std::numeric_limits<uint32_t>::max();
+  std::vector<TrackedTriangle> current;
+  current.reserve(tiling.triangles.size());
+  for (const auto &triangle : tiling.triangles) {
+    current.push_back({triangle, noOwner});
+  }
+  size_t currentLevel = 0;
+  for (size_t l = 0; l + 1 < levels.size(); ++l) {
+    current = deflate(std::move(current), tables, currentLevel, static_cast<size_t>(levels[l]), area, false, firstLevel);
+    currentLevel = static_cast<size_t>(levels[l]);
+
+    // the first half of each tile is registered, the other one finds it by its center
+    const PackedLevel &table = tables[currentLevel];
+    PointSet centers(current.size() / 2 + 1, std::sqrt(epsilon));
+    std::vector<PackedTriangle> tiles;
+    std::vector<uint32_t> parents;
+    for (auto &item : current) {
+      const PackedTriangle &triangle = item.triangle;
+      const Point center = Point(triangle.x, triangle.y) + table.shape(triangle).center;
+      uint32_t tile = centers.find(center);
+      if (tile == PointSet::none) {
+        tile = centers.insert(center);
+        tiles.push_back(triangle);
+        parents.push_back(item.owner);
+      }
+      item.owner = tile;
+    }
+    hierarchy.levels.push_back(levels[l]);
+    hierarchy.tiles.push_back(std::move(tiles));
+    hierarchy.parents.push_back(l == 0 ? std::vector<uint32_t>{} : std::move(parents));
+  }
+
+  const std::vector<TrackedTriangle> last = deflateAndMerge(current, tables, currentLevel, threads, area, firstLevel);
+  std::vector<PackedTriangle> tiles;
+  std::vector<uint32_t> parents;
+  tiles.reserve(last.size());
+  parents.reserve(last.size());
+  for (const auto &item : last) {
+    tiles.push_back(item.triangle);
+    parents.push_back(item.owner);
+  }
+  hierarchy.levels.push_back(levels.back());
+  hierarchy.tiles.push_back(std::move(tiles));
+  hierarchy.parents.push_back(levels.size() == 1 ? std::vector<uint32_t>{} : std::move(parents));
+  stats::add("tiles", hierarchy.tiles.back().size());
+  return hierarchy;
+}
+
+// Completed quadrilateral of a triangle of a merged tiling, table is the level of the tiling
+inline PenroseQuadrilateral toQuadrilateral(const PackedTriangle &triangle, const PackedLevel &table) {
+  const auto &[A, B, C, D] = table.vertices(triangle).vertices;
+  return {static_cast<TriangleKind>(triangle.kind), A, B, C, D, triangle.flag};
+}
+
+// Completed quadrilaterals of the triangles of a merged tiling
+inline std::vector<PenroseQuadrilateral> toQuadrilaterals(const PackedTiling &tiling) {
+  const PackedLevel table(tiling.frame, tiling.level);
+  std::vector<PenroseQuadrilateral> newList;
+  newList.reserve(tiling.triangles.size());
+  for (const auto &triangle : tiling.triangles) {
+    newList.push_back(toQuadrilateral(triangle, table));
+  }
+  return newList;
+}
+
+// Random access view of the completed quadrilaterals of triangles, each one is rebuilt when it is read.
+// table must outlive the view.
+inline auto quadrilateralView(std::span<const PackedTriangle> triangles, const PackedLevel &table) {
+  return triangles | std::views::transform([&table](const PackedTriangle &triangle) {
+    return toQuadrilateral(triangle, table);
+  });
+}
+
+} // namespace penrose
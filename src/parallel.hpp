@@ -0,0 +1,136 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+// 0 or negative value means one thread per hardware core
+inline size_t threadCount(int requested) {
+  if (requested > 0) {
+    return static_cast<size_t>(requested);
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Call function(idx) for idx in [0, count) on up to threads threads.
+// Indices are distributed dynamically so uneven tasks still balance across threads.
+// The first exception thrown by a task is rethrown in the calling thread.
+template <typename Function>
+void forEach(size_t count, int threads, Function &&function) {
+  const size_t workers = std::min(count, threadCount(threads));
+  if (workers <= 1) {
+    for (size_t idx = 0; idx < count; ++idx) {
+      function(idx);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next = 0;
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto worker = [&]() {
+    for (size_t idx = next++; idx < count; idx = next++) {
+      try {
+        function(idx);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(workers - 1);
+  for (size_t w = 1; w < workers; ++w) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Fixed set of threads running the submitted tasks in order of submission, for long running programs
+// where tasks arrive one by one. The destructor waits for the tasks already submitted.
+// A task is expected to handle its own exceptions.
+class ThreadPool {
+public:
+  explicit ThreadPool(int threads) {
+    const size_t workers = threadCount(threads);
+    for (size_t w = 0; w < workers; ++w) {
+      pool.emplace_back([this] { work(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (auto &thread : pool) {
+      thread.join();
+    }
+  }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+  }
+
+private:
+  void work() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> tasks;
+  bool stopping = false;
+  std::vector<std::thread> pool;
+};
+
+} // namespace parallel
@@ -11,10 +11,22 @@
 #pragma once
 
 #include <geometry.hpp>
+#include <parallel.hpp>
+#include <rng.hpp>
+#include <simd.hpp>
+#include <stats.hpp>
+
+#include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
+#include <limits>
+#include <ranges>
+#include <span>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <random>
 
@@ -36,111 +48,315 @@ inline bool isSmall(TriangleKind kind) {
   return kind == TriangleKind::kKite || kind == TriangleKind::kRhombsCyan;
 }
 
-struct PenroseTriangle : Triangle {
+template <typename PointT>
+struct BasicPenroseTriangle : BasicTriangle<PointT> {
   TriangleKind color;
   bool flag;
 
-  PenroseTriangle(TriangleKind color, Point A, Point B, Point C, bool flag = false)
-      : Triangle(A, B, C), color(color), flag(flag) {
+  BasicPenroseTriangle(TriangleKind color, PointT A, PointT B, PointT C, bool flag = false)
+      : BasicTriangle<PointT>(A, B, C), color(color), flag(flag) {
   }
 
 };
 
-struct PenroseQuadrilateral : Quadrilateral {
+template <typename PointT>
+struct BasicPenroseQuadrilateral : BasicQuadrilateral<PointT> {
   TriangleKind color;
   bool flag;
 
-  PenroseQuadrilateral(TriangleKind color, Point A, Point B, Point C, Point D, bool flag)
-      : Quadrilateral(A, B, C, D), color(color), flag(flag) {
-  }
-};
-
-std::vector<PenroseTriangle> deflate(const PenroseTriangle &triangle) {
-  const Point A = triangle.vertices[0];
-  const Point B = triangle.vertices[1];
-  const Point C = triangle.vertices[2];
-
-  switch (triangle.color) {
-  case TriangleKind::kDart: {
-    const Point R = A + (B - A) / goldenRatio;
-    const Point Q = B + (C - B) / goldenRatio;
-    return std::vector<PenroseTriangle>{
-        {TriangleKind::kDart, R, A, Q, triangle.flag},
-        {TriangleKind::kDart, C, A, Q, triangle.flag},
-        {TriangleKind::kKite, Q, B, R, triangle.flag}};
-  } break;
-  case TriangleKind::kKite: {
-    const Point P = B + (A - B) / goldenRatio;
-    return std::vector<PenroseTriangle>{
-        {TriangleKind::kKite, C, A, P, triangle.flag},
-        {TriangleKind::kDart, P, B, C, triangle.flag}};
-  } break;
-  case TriangleKind::kRhombsCyan: {
-    const Point P = A + (B - A) / goldenRatio;
-    return std::vector<PenroseTriangle>{
-        {TriangleKind::kRhombsCyan, C, P, B, triangle.flag},
-        {TriangleKind::kRhombsViolet, P, C, A, triangle.flag}};
-  } break;
-  case TriangleKind::kRhombsViolet: {
-    const Point Q = B + (A - B) / goldenRatio;
-    const Point R = B + (C - B) / goldenRatio;
-    return std::vector<PenroseTriangle>{
-        {TriangleKind::kRhombsViolet, R, C, A, triangle.flag},
-        {TriangleKind::kRhombsViolet, Q, R, B, triangle.flag},
-        {TriangleKind::kRhombsCyan, R, Q, A, triangle.flag}};
-  } break;
-  default:
+  BasicPenroseQuadrilateral(TriangleKind color, PointT A, PointT B, PointT C, PointT D, bool flag)
+      : BasicQuadrilateral<PointT>(A, B, C, D), color(color), flag(flag) {
+  }
+};
+
+using PenroseTriangle = BasicPenroseTriangle<Point>;
+using PenroseQuadrilateral = BasicPenroseQuadrilateral<Point>;
+
+// The 2 operations needed by the deflation, each point type provides its own overloads
+
+// Point at 1/divisor of the way from A to B
+inline Point pointOnSegment(const Point &A, const Point &B, float divisor) {
+  return A + (B - A) / divisor;
+}
+
+// Mirror of A along the line BC
+inline Point mirror(const Point &A, const Point &B, const Point &C) {
+  return A + 2 * ((B - A) + (C - B) * scalar(A - B, C - B) / scalar(C - B, C - B));
+}
+
+// =================================================================================================
+// Substitution rules
+// A substitution tiling is a constexpr table : each prototile kind is replaced by children whose
+// vertices are corners of the parent or points on its edges. The deflation loops are generated from
+// the table for each kind, so there is no branch on the kind inside them.
+
+// Child vertex : the point at 1/divisor of the way from parent corner `from` to parent corner `to`,
+// or the corner `from` itself when both are the same
+struct RuleVertex {
+  size_t from;
+  size_t to;
+  float divisor;
+};
+
+constexpr RuleVertex corner(size_t v) {
+  return {v, v, 1.f};
+}
+
+constexpr RuleVertex onEdge(size_t from, size_t to, float divisor) {
+  return {from, to, divisor};
+}
+
+struct RuleChild {
+  TriangleKind kind;
+  std::array<RuleVertex, 3> vertices;
+};
+
+// The count first children replace a prototile of kind
+template <size_t MaxChildren>
+struct Rule {
+  TriangleKind kind;
+  size_t count;
+  std::array<RuleChild, MaxChildren> children;
+};
+
+// Kite and dart tiling (P2)
+struct KiteDart {
+  static constexpr float inflation = goldenRatio;
+  static constexpr std::array<Rule<3>, 2> rules = {{
+      {TriangleKind::kDart, 3, {{
+          {TriangleKind::kDart, {onEdge(0, 1, inflation), corner(0), onEdge(1, 2, inflation)}},
+          {TriangleKind::kDart, {corner(2), corner(0), onEdge(1, 2, inflation)}},
+          {TriangleKind::kKite, {onEdge(1, 2, inflation), corner(1), onEdge(0, 1, inflation)}},
+      }}},
+      {TriangleKind::kKite, 2, {{
+          {TriangleKind::kKite, {corner(2), corner(0), onEdge(1, 0, inflation)}},
+          {TriangleKind::kDart, {onEdge(1, 0, inflation), corner(1), corner(2)}},
+      }}},
+  }};
+};
+
+// Rhombus tiling (P3)
+struct Rhombus {
+  static constexpr float inflation = goldenRatio;
+  static constexpr std::array<Rule<3>, 2> rules = {{
+      {TriangleKind::kRhombsCyan, 2, {{
+          {TriangleKind::kRhombsCyan, {corner(2), onEdge(0, 1, inflation), corner(1)}},
+          {TriangleKind::kRhombsViolet, {onEdge(0, 1, inflation), corner(2), corner(0)}},
+      }}},
+      {TriangleKind::kRhombsViolet, 3, {{
+          {TriangleKind::kRhombsViolet, {onEdge(1, 2, inflation), corner(2), corner(0)}},
+          {TriangleKind::kRhombsViolet, {onEdge(1, 0, inflation), onEdge(1, 2, inflation), corner(1)}},
+          {TriangleKind::kRhombsCyan, {onEdge(1, 2, inflation), onEdge(1, 0, inflation), corner(0)}},
+      }}},
+  }};
+};
+
+// Both tilings are stored in the same buckets and deflated together
+static_assert(KiteDart::inflation == Rhombus::inflation);
+constexpr float inflation = KiteDart::inflation;
+
+using SubstitutionMatrix = std::array<std::array<size_t, 4>, 4>;
+
+// Number of children of each kind produced by one deflation of a parent
+// row : parent kind, column : children kind (same order as TriangleKind)
+template <typename Tiling>
+constexpr SubstitutionMatrix makeSubstitutionMatrix() {
+  SubstitutionMatrix matrix = {};
+  for (const auto &rule : Tiling::rules) {
+    for (size_t child = 0; child < rule.count; ++child) {
+      ++matrix[static_cast<size_t>(rule.kind)][static_cast<size_t>(rule.children[child].kind)];
+    }
+  }
+  return matrix;
+}
+
+constexpr SubstitutionMatrix substitutionMatrix = [] {
+  SubstitutionMatrix matrix = makeSubstitutionMatrix<KiteDart>();
+  const SubstitutionMatrix rhombus = makeSubstitutionMatrix<Rhombus>();
+  for (size_t parent = 0; parent < matrix.size(); ++parent) {
+    for (size_t child = 0; child < matrix.size(); ++child) {
+      matrix[parent][child] += rhombus[parent][child];
+    }
+  }
+  return matrix;
+}();
+
+// Vertex V of child C of rule R, parent holds the parent corners
+template <typename Tiling, size_t R, size_t C, size_t V, typename PointT>
+PointT childVertex(const std::array<PointT, 3> &parent) {
+  constexpr RuleVertex vertex = Tiling::rules[R].children[C].vertices[V];
+  if constexpr (vertex.from == vertex.to) {
+    return parent[vertex.from];
+  } else {
+    return pointOnSegment(parent[vertex.from], parent[vertex.to], vertex.divisor);
+  }
+}
+
+// Vertex of a child whose rule is only known at runtime
+template <typename PointT>
+PointT childVertex(const std::array<PointT, 3> &parent, const RuleVertex &vertex) {
+  if (vertex.from == vertex.to) {
+    return parent[vertex.from];
+  }
+  return pointOnSegment(parent[vertex.from], parent[vertex.to], vertex.divisor);
+}
+
+using KindCount = std::array<size_t, 4>;
+
+template <typename PointT>
+KindCount countKinds(const std::vector<BasicPenroseTriangle<PointT>> &triangles) {
+  KindCount count = {};
+  for (const auto &triangle : triangles) {
+    ++count[static_cast<size_t>(triangle.color)];
+  }
+  return count;
+}
+
+inline KindCount countAfterDeflation(KindCount count, int level) {
+  for (int l = 0; l < level; ++l) {
+    KindCount next = {};
+    for (size_t parent = 0; parent < count.size(); ++parent) {
+      for (size_t child = 0; child < count.size(); ++child) {
+        next[child] += count[parent] * substitutionMatrix[parent][child];
+      }
+    }
+    count = next;
+  }
+  return count;
+}
+
+inline size_t total(const KindCount &count) {
+  size_t sum = 0;
+  for (size_t c : count) {
+    sum += c;
+  }
+  return sum;
+}
+
+// Write the children of triangle if it is a prototile of Tiling, return false otherwise
+template <typename Tiling, typename PointT, typename OutputIt>
+bool deflate(const BasicPenroseTriangle<PointT> &triangle, OutputIt &out) {
+  auto deflateRule = [&]<size_t R>(std::integral_constant<size_t, R>) {
+    constexpr auto rule = Tiling::rules[R];
+    [&]<size_t... C>(std::index_sequence<C...>) {
+      ((*out++ = BasicPenroseTriangle<PointT>{rule.children[C].kind,
+                                              childVertex<Tiling, R, C, 0>(triangle.vertices),
+                                              childVertex<Tiling, R, C, 1>(triangle.vertices),
+                                              childVertex<Tiling, R, C, 2>(triangle.vertices),
+                                              triangle.flag}),
+       ...);
+    }(std::make_index_sequence<rule.count>{});
+  };
+  return [&]<size_t... R>(std::index_sequence<R...>) {
+    return ((triangle.color == Tiling::rules[R].kind && (deflateRule(std::integral_constant<size_t, R>{}), true)) || ...);
+  }(std::make_index_sequence<Tiling::rules.size()>{});
+}
+
+template <typename PointT, typename OutputIt>
+OutputIt deflate(const BasicPenroseTriangle<PointT> &triangle, OutputIt out) {
+  if (!deflate<KiteDart>(triangle, out) && !deflate<Rhombus>(triangle, out)) {
     throw std::runtime_error("Unknown penrose type");
-    break;
   }
+  return out;
 }
 
-std::vector<PenroseTriangle> deflate(const std::vector<PenroseTriangle> &triangles) {
-  std::vector<PenroseTriangle> newList;
+template <typename PointT>
+std::vector<BasicPenroseTriangle<PointT>> deflate(const BasicPenroseTriangle<PointT> &triangle) {
+  std::vector<BasicPenroseTriangle<PointT>> newList;
+  newList.reserve(3);
+  deflate(triangle, std::back_inserter(newList));
+  return newList;
+}
+
+// Deflate all triangles into output, output capacity is expected to be already large enough
+template <typename PointT>
+void deflate(const std::vector<BasicPenroseTriangle<PointT>> &triangles, std::vector<BasicPenroseTriangle<PointT>> &output) {
+  output.clear();
+  auto out = std::back_inserter(output);
   for (const auto &triangle : triangles) {
-    const auto small = deflate(triangle);
-    std::move(small.begin(), small.end(), std::back_inserter(newList));
+    out = deflate(triangle, out);
   }
+}
+
+template <typename PointT>
+std::vector<BasicPenroseTriangle<PointT>> deflate(const std::vector<BasicPenroseTriangle<PointT>> &triangles) {
+  std::vector<BasicPenroseTriangle<PointT>> newList;
+  newList.reserve(total(countAfterDeflation(countKinds(triangles), 1)));
+  deflate(triangles, newList);
   return newList;
 }
 
-PenroseQuadrilateral completeShape(const PenroseTriangle &triangle) {
-    const Point A = triangle.vertices[0];
-    const Point B = triangle.vertices[1];
-    const Point C = triangle.vertices[2];
-    const Point D = A + 2 * ((B-A) + (C-B) * scalar(A-B, C-B) / scalar(C-B, C-B));
-    return {triangle.color, A, B, C, D, triangle.flag};
+// Deflate level times using 2 ping-pong buffers sized once from the substitution matrix
+template <typename PointT>
+std::vector<BasicPenroseTriangle<PointT>> deflate(const std::vector<BasicPenroseTriangle<PointT>> &triangles, int level) {
+  if (level <= 0) {
+    return triangles;
+  }
+  const KindCount count = countKinds(triangles);
+  // the buffer written at the last iteration hold the final level, the other one at most the previous level
+  std::vector<BasicPenroseTriangle<PointT>> current;
+  std::vector<BasicPenroseTriangle<PointT>> next;
+  next.reserve(total(countAfterDeflation(count, level)));
+  current.reserve(std::max(triangles.size(), total(countAfterDeflation(count, level - 1))));
+  if (level % 2 == 0) {
+    std::swap(current, next);
+  }
+  current.assign(triangles.begin(), triangles.end());
+
+  for (int l = 0; l < level; ++l) {
+    deflate(current, next);
+    std::swap(current, next);
+  }
+  return current;
 }
 
-std::vector<PenroseQuadrilateral> completeShape(const std::vector<PenroseTriangle> &triangles) {
-  std::vector<PenroseQuadrilateral> newList;
+template <typename PointT>
+BasicPenroseQuadrilateral<PointT> completeShape(const BasicPenroseTriangle<PointT> &triangle) {
+    const PointT A = triangle.vertices[0];
+    const PointT B = triangle.vertices[1];
+    const PointT C = triangle.vertices[2];
+    return {triangle.color, A, B, C, mirror(A, B, C), triangle.flag};
+}
+
+template <typename PointT>
+std::vector<BasicPenroseQuadrilateral<PointT>> completeShape(const std::vector<BasicPenroseTriangle<PointT>> &triangles) {
+  std::vector<BasicPenroseQuadrilateral<PointT>> newList;
+  newList.reserve(triangles.size());
   for (const auto &triangle : triangles) {
     newList.push_back(completeShape(triangle));
   }
   return newList;
 }
 
-std::vector<PenroseTriangle> splitShape(const PenroseQuadrilateral &triangle) {
-    const Point A = triangle.vertices[0];
-    const Point B = triangle.vertices[1];
-    const Point C = triangle.vertices[2];
-    const Point D = triangle.vertices[3];
+template <typename PointT>
+std::vector<BasicPenroseTriangle<PointT>> splitShape(const BasicPenroseQuadrilateral<PointT> &triangle) {
+    const PointT A = triangle.vertices[0];
+    const PointT B = triangle.vertices[1];
+    const PointT C = triangle.vertices[2];
+    const PointT D = triangle.vertices[3];
     return {
       {triangle.color, A, B, C, triangle.flag},
       {triangle.color, D, B, C, triangle.flag}
     };
 }
 
-std::vector<PenroseTriangle> splitShape(const std::vector<PenroseQuadrilateral> &quadrilaterals) {
-  std::vector<PenroseTriangle> newList;
+template <typename PointT>
+std::vector<BasicPenroseTriangle<PointT>> splitShape(const std::vector<BasicPenroseQuadrilateral<PointT>> &quadrilaterals) {
+  const stats::Timer timer("splitShape");
+  std::vector<BasicPenroseTriangle<PointT>> newList;
+  newList.reserve(2 * quadrilaterals.size());
   for (const auto &quad : quadrilaterals) {
-    const auto triangles = splitShape(quad);
-    std::move(triangles.begin(), triangles.end(), std::back_inserter(newList));
+    const PointT A = quad.vertices[0];
+    const PointT B = quad.vertices[1];
+    const PointT C = quad.vertices[2];
+    const PointT D = quad.vertices[3];
+    newList.emplace_back(quad.color, A, B, C, quad.flag);
+    newList.emplace_back(quad.color, D, B, C, quad.flag);
   }
   return newList;
 }
 
-Point moveMargin(const Point& A, const Point& B, const Point& C, const Point& D, const float margin) {
+inline Point moveMargin(const Point& A, const Point& B, const Point& C, const Point& D, const float margin) {
   // D is here only to indicate margin direction
   const Point AO = (C-A) / norm(C-A) + (B-A) / norm(B-A);
   const float direction = scalar(AO, D-A) > 0.f ? 1.f : -1.f;
@@ -150,43 +366,1438 @@ Point moveMargin(const Point& A, const Point& B, const Point& C, const Point& D,
   return Am;
 }
 
-std::vector<PenroseQuadrilateral> addMargin(const std::vector<PenroseQuadrilateral> &quadrilaterals, const float margin) {
+// One triangle of each kind, in the order of TriangleKind. Kinds of the same tiling have their relative
+// size in a tiling : the first edge of the dart and of the cyan rhombus is 1.
+inline const std::vector<PenroseTriangle> &referenceTriangles() {
+  static const std::vector<PenroseTriangle> references = [] {
+    const std::vector<PenroseTriangle> prototiles = {
+        {TriangleKind::kDart, Point(std::cos(pi / 10), std::sin(pi / 10)), Point(0, 0), Point(std::cos(pi / 10), -std::sin(pi / 10))},
+        {TriangleKind::kRhombsCyan, Point(0, 0), Point(std::cos(pi / 10), std::sin(pi / 10)), Point(std::cos(pi / 10), -std::sin(pi / 10))},
+    };
+    // the other kinds are children of the prototiles, scaled back to the size of their parent
+    std::vector<PenroseTriangle> candidates = prototiles;
+    std::vector<PenroseTriangle> children;
+    for (const auto &triangle : prototiles) {
+      deflate(triangle, std::back_inserter(children));
+    }
+    for (const auto &child : children) {
+      candidates.emplace_back(child.color, inflation * child.vertices[0], inflation * child.vertices[1], inflation * child.vertices[2]);
+    }
+    std::vector<PenroseTriangle> references;
+    for (size_t kind = 0; kind < 4; ++kind) {
+      references.push_back(*std::find_if(candidates.begin(), candidates.end(), [&](const PenroseTriangle &triangle) {
+        return static_cast<size_t>(triangle.color) == kind;
+      }));
+    }
+    return references;
+  }();
+  return references;
+}
+
+// =================================================================================================
+// Structure of arrays storage
+// Tiles are bucketed by TriangleKind and each vertex coordinate get its own array,
+// so the kernels below run without branch on 8 (AVX2) or 4 (SSE2) tiles at a time.
+
+template <typename V>
+struct PointPack {
+  V x;
+  V y;
+};
+
+template <typename V>
+PointPack<V> operator+(const PointPack<V> &pt1, const PointPack<V> &pt2) {
+  return {pt1.x + pt2.x, pt1.y + pt2.y};
+}
+template <typename V>
+PointPack<V> operator-(const PointPack<V> &pt1, const PointPack<V> &pt2) {
+  return {pt1.x - pt2.x, pt1.y - pt2.y};
+}
+template <typename V>
+PointPack<V> operator*(const PointPack<V> &pt, V value) {
+  return {value * pt.x, value * pt.y};
+}
+template <typename V>
+PointPack<V> operator/(const PointPack<V> &pt, V value) {
+  return {pt.x / value, pt.y / value};
+}
+template <typename V>
+PointPack<V> pointOnSegment(const PointPack<V> &A, const PointPack<V> &B, float divisor) {
+  return A + (B - A) / V::broadcast(divisor);
+}
+template <typename V>
+V scalar(const PointPack<V> &pt1, const PointPack<V> &pt2) {
+  return pt1.x * pt2.x + pt1.y * pt2.y;
+}
+template <typename V>
+V norm(const PointPack<V> &pt) {
+  return simd::sqrt(pt.x * pt.x + pt.y * pt.y);
+}
+template <typename V>
+PointPack<V> mirror(const PointPack<V> &A, const PointPack<V> &B, const PointPack<V> &C) {
+  return A + ((B - A) + (C - B) * scalar(A - B, C - B) / scalar(C - B, C - B)) * V::broadcast(2.f);
+}
+template <typename V>
+PointPack<V> turn90(const PointPack<V> &pt) {
+  return {V::broadcast(0.f) - pt.y, pt.x};
+}
+
+// N vertices polygons of the same kind
+template <size_t N>
+struct PolygonArray {
+  std::array<std::vector<float>, N> x;
+  std::array<std::vector<float>, N> y;
+  std::vector<uint8_t> flag;
+
+  size_t size() const {
+    return flag.size();
+  }
+
+  void reserve(size_t count) {
+    for (size_t v = 0; v < N; ++v) {
+      x[v].reserve(count);
+      y[v].reserve(count);
+    }
+    flag.reserve(count);
+  }
+
+  void resize(size_t count) {
+    for (size_t v = 0; v < N; ++v) {
+      x[v].resize(count);
+      y[v].resize(count);
+    }
+    flag.resize(count);
+  }
+
+  void push_back(const std::array<Point, N> &vertices, bool value) {
+    for (size_t v = 0; v < N; ++v) {
+      x[v].push_back(vertices[v].x);
+      y[v].push_back(vertices[v].y);
+    }
+    flag.push_back(value);
+  }
+
+  PolygonArray slice(size_t first, size_t count) const {
+    PolygonArray array;
+    for (size_t v = 0; v < N; ++v) {
+      array.x[v].assign(x[v].begin() + first, x[v].begin() + first + count);
+      array.y[v].assign(y[v].begin() + first, y[v].begin() + first + count);
+    }
+    array.flag.assign(flag.begin() + first, flag.begin() + first + count);
+    return array;
+  }
+
+  // Copy all polygons in output starting at first, output is expected to be already large enough
+  void copyTo(PolygonArray &output, size_t first) const {
+    for (size_t v = 0; v < N; ++v) {
+      std::copy(x[v].begin(), x[v].end(), output.x[v].begin() + first);
+      std::copy(y[v].begin(), y[v].end(), output.y[v].begin() + first);
+    }
+    std::copy(flag.begin(), flag.end(), output.flag.begin() + first);
+  }
+
+  void move(size_t from, size_t to) {
+    for (size_t v = 0; v < N; ++v) {
+      x[v][to] = x[v][from];
+      y[v][to] = y[v][from];
+    }
+    flag[to] = flag[from];
+  }
+
+  Point vertex(size_t v, size_t idx) const {
+    return {x[v][idx], y[v][idx]};
+  }
+
+  template <typename V>
+  PointPack<V> load(size_t v, size_t idx) const {
+    return {V::load(&x[v][idx]), V::load(&y[v][idx])};
+  }
+
+  template <typename V, typename... Points>
+  void store(size_t idx, const Points &...vertices) {
+    static_assert(sizeof...(Points) == N, "Wrong number of vertices");
+    size_t v = 0;
+    ((vertices.x.store(&x[v][idx]), vertices.y.store(&y[v][idx]), ++v), ...);
+  }
+};
+
+using TriangleArray = PolygonArray<3>;
+using QuadrilateralArray = PolygonArray<4>;
+
+// One array per TriangleKind, indexed by the enum value
+using TriangleSoA = std::array<TriangleArray, 4>;
+using QuadrilateralSoA = std::array<QuadrilateralArray, 4>;
+
+inline TriangleSoA toSoA(const std::vector<PenroseTriangle> &triangles) {
+  TriangleSoA buckets;
+  const KindCount count = countKinds(triangles);
+  for (size_t kind = 0; kind < buckets.size(); ++kind) {
+    buckets[kind].reserve(count[kind]);
+  }
+  for (const auto &triangle : triangles) {
+    buckets[static_cast<size_t>(triangle.color)].push_back(triangle.vertices, triangle.flag);
+  }
+  return buckets;
+}
+
+inline std::vector<PenroseTriangle> toTriangles(const TriangleSoA &buckets) {
+  std::vector<PenroseTriangle> newList;
+  newList.reserve(buckets[0].size() + buckets[1].size() + buckets[2].size() + buckets[3].size());
+  for (size_t kind = 0; kind < buckets.size(); ++kind) {
+    const TriangleArray &array = buckets[kind];
+    for (size_t idx = 0; idx < array.size(); ++idx) {
+      newList.emplace_back(static_cast<TriangleKind>(kind), array.vertex(0, idx), array.vertex(1, idx), array.vertex(2, idx), array.flag[idx]);
+    }
+  }
+  return newList;
+}
+
+inline std::vector<PenroseQuadrilateral> toQuadrilaterals(const QuadrilateralSoA &buckets) {
+  std::vector<PenroseQuadrilateral> newList;
+  newList.reserve(buckets[0].size() + buckets[1].size() + buckets[2].size() + buckets[3].size());
+  for (size_t kind = 0; kind < buckets.size(); ++kind) {
+    const QuadrilateralArray &array = buckets[kind];
+    for (size_t idx = 0; idx < array.size(); ++idx) {
+      newList.emplace_back(static_cast<TriangleKind>(kind), array.vertex(0, idx), array.vertex(1, idx), array.vertex(2, idx), array.vertex(3, idx), array.flag[idx]);
+    }
+  }
+  return newList;
+}
+
+template <size_t N>
+KindCount countKinds(const std::array<PolygonArray<N>, 4> &buckets) {
+  return {buckets[0].size(), buckets[1].size(), buckets[2].size(), buckets[3].size()};
+}
+
+// Deflate the prototiles of Tiling into output, children of each rule are written at offset in their bucket
+template <typename Tiling>
+void deflate(const TriangleSoA &triangles, TriangleSoA &output, KindCount &offset) {
+  auto deflateRule = [&]<size_t R>(std::integral_constant<size_t, R>) {
+    constexpr auto rule = Tiling::rules[R];
+    const TriangleArray &in = triangles[static_cast<size_t>(rule.kind)];
+    std::array<size_t, rule.count> first;
+    for (size_t child = 0; child < rule.count; ++child) {
+      first[child] = offset[static_cast<size_t>(rule.children[child].kind)];
+      offset[static_cast<size_t>(rule.children[child].kind)] += in.size();
+    }
+    simd::forEach(in.size(), [&](auto tag, size_t idx) {
+      using V = decltype(tag);
+      const std::array<PointPack<V>, 3> parent = {in.load<V>(0, idx), in.load<V>(1, idx), in.load<V>(2, idx)};
+      [&]<size_t... C>(std::index_sequence<C...>) {
+        (output[static_cast<size_t>(rule.children[C].kind)].template store<V>(first[C] + idx,
+                                                                            childVertex<Tiling, R, C, 0>(parent),
+                                                                            childVertex<Tiling, R, C, 1>(parent),
+                                                                            childVertex<Tiling, R, C, 2>(parent)),
+         ...);
+      }(std::make_index_sequence<rule.count>{});
+    });
+    for (size_t child = 0; child < rule.count; ++child) {
+      TriangleArray &out = output[static_cast<size_t>(rule.children[child].kind)];
+      std::copy(in.flag.begin(), in.flag.end(), out.flag.begin() + first[child]);
+    }
+  };
+  [&]<size_t... R>(std::index_sequence<R...>) {
+    (deflateRule(std::integral_constant<size_t, R>{}), ...);
+  }(std::make_index_sequence<Tiling::rules.size()>{});
+}
+
+// Deflate all triangles into output, output buckets capacity is expected to be already large enough
+inline void deflate(const TriangleSoA &triangles, TriangleSoA &output) {
+  const KindCount count = countAfterDeflation(countKinds(triangles), 1);
+  for (size_t kind = 0; kind < output.size(); ++kind) {
+    output[kind].resize(count[kind]);
+  }
+  // next free index in each output bucket
+  KindCount offset = {};
+  deflate<KiteDart>(triangles, output, offset);
+  deflate<Rhombus>(triangles, output, offset);
+}
+
+// Deflate level times using 2 ping-pong buffers sized once from the substitution matrix.
+// firstLevel is the level of the input triangles, it is only used to record tile counts.
+inline TriangleSoA deflate(const TriangleSoA &triangles, int level, int firstLevel = 0) {
+  if (level <= 0) {
+    return triangles;
+  }
+  const KindCount count = countKinds(triangles);
+  const KindCount last = countAfterDeflation(count, level);
+  const KindCount previous = countAfterDeflation(count, level - 1);
+  TriangleSoA current;
+  TriangleSoA next;
+  for (size_t kind = 0; kind < count.size(); ++kind) {
+    next[kind].reserve(last[kind]);
+    current[kind].reserve(std::max(count[kind], previous[kind]));
+  }
+  if (level % 2 == 0) {
+    std::swap(current, next);
+  }
+  for (size_t kind = 0; kind < count.size(); ++kind) {
+    current[kind].resize(count[kind]);
+    triangles[kind].copyTo(current[kind], 0);
+  }
+
+  for (int l = 0; l < level; ++l) {
+    deflate(current, next);
+    std::swap(current, next);
+    if (stats::enabled()) {
+      stats::addTiles(firstLevel + l + 1, countKinds(current));
+    }
+  }
+  return current;
+}
+
+template <size_t N>
+float longestEdge(const std::array<PolygonArray<N>, 4> &polygons) {
+  float longest = 0.f;
+  for (const auto &array : polygons) {
+    for (size_t idx = 0; idx < array.size(); ++idx) {
+      for (size_t v = 0; v < N; ++v) {
+        longest = std::max(longest, norm(array.vertex(v, idx) - array.vertex((v + 1) % N, idx)));
+      }
+    }
+  }
+  return longest;
+}
+
+// Remove polygons whose bounding box doesn't intersect clip.
+// Return true if all remaining polygons are inside clip, their descendants don't need to be checked anymore.
+template <size_t N>
+bool cull(PolygonArray<N> &polygons, const Rectangle &clip) {
+  bool inside = true;
+  size_t kept = 0;
+  for (size_t idx = 0; idx < polygons.size(); ++idx) {
+    Rectangle box(polygons.vertex(0, idx), polygons.vertex(0, idx));
+    for (size_t v = 1; v < N; ++v) {
+      box.min = {std::min(box.min.x, polygons.x[v][idx]), std::min(box.min.y, polygons.y[v][idx])};
+      box.max = {std::max(box.max.x, polygons.x[v][idx]), std::max(box.max.y, polygons.y[v][idx])};
+    }
+    if (!intersects(clip, box)) {
+      continue;
+    }
+    inside = inside && contains(clip, box);
+    if (kept != idx) {
+      polygons.move(idx, kept);
+    }
+    ++kept;
+  }
+  polygons.resize(kept);
+  return inside;
+}
+
+template <size_t N>
+bool cull(std::array<PolygonArray<N>, 4> &polygons, const Rectangle &clip) {
+  bool inside = true;
+  for (auto &array : polygons) {
+    inside = cull(array, clip) && inside;
+  }
+  return inside;
+}
+
+// Deflate level times and drop triangles outside clip before their subdivision.
+// Final tiles extend past their triangle, the caller is expected to enlarge clip by a tile size.
+inline TriangleSoA deflate(const TriangleSoA &triangles, int level, const Rectangle &clip, int firstLevel = 0) {
+  TriangleSoA current = triangles;
+  TriangleSoA next;
+  for (int l = 0; l < level; ++l) {
+    if (cull(current, clip)) {
+      return deflate(current, level - l, firstLevel + l);
+    }
+    deflate(current, next);
+    std::swap(current, next);
+    if (stats::enabled()) {
+      stats::addTiles(firstLevel + l + 1, countKinds(current));
+    }
+  }
+  cull(current, clip);
+  return current;
+}
+
+// Write the completed shapes at offset in each output bucket, output buckets are expected to be already large enough
+inline void completeShape(const TriangleSoA &triangles, QuadrilateralSoA &output, const KindCount &offset) {
+  for (size_t kind = 0; kind < triangles.size(); ++kind) {
+    const TriangleArray &in = triangles[kind];
+    QuadrilateralArray &out = output[kind];
+    const size_t first = offset[kind];
+    simd::forEach(in.size(), [&](auto tag, size_t idx) {
+      using V = decltype(tag);
+      const auto A = in.load<V>(0, idx);
+      const auto B = in.load<V>(1, idx);
+      const auto C = in.load<V>(2, idx);
+      out.store<V>(first + idx, A, B, C, mirror(A, B, C));
+    });
+    std::copy(in.flag.begin(), in.flag.end(), out.flag.begin() + first);
+  }
+}
+
+inline QuadrilateralSoA completeShape(const TriangleSoA &triangles) {
+  QuadrilateralSoA quadrilaterals;
+  for (size_t kind = 0; kind < triangles.size(); ++kind) {
+    quadrilaterals[kind].resize(triangles[kind].size());
+  }
+  completeShape(triangles, quadrilaterals, {});
+  return quadrilaterals;
+}
+
+// Levels are deflated sequentially until they contain parallelMinTriangles triangles,
+// then each chunk of parallelTaskSize triangles is deflated as an independent task.
+// Tasks only depend on the input and not on the thread count so the output is always the same.
+constexpr size_t parallelMinTriangles = 1024;
+constexpr size_t parallelTaskSize = 16;
+
+// Split polygons in tasks of parallelTaskSize polygons of the same kind
+template <size_t N>
+std::vector<std::array<PolygonArray<N>, 4>> splitTasks(const std::array<PolygonArray<N>, 4> &polygons) {
+  std::vector<std::array<PolygonArray<N>, 4>> tasks;
+  for (size_t kind = 0; kind < polygons.size(); ++kind) {
+    for (size_t first = 0; first < polygons[kind].size(); first += parallelTaskSize) {
+      tasks.emplace_back()[kind] = polygons[kind].slice(first, std::min(parallelTaskSize, polygons[kind].size() - first));
+    }
+  }
+  return tasks;
+}
+
+// Run the tasks of polygons and concatenate their quadrilaterals in task order.
+// count(task) is the size of the output of a task, known before running it, so write(task, output, offset)
+// directly writes it at its final place.
+template <size_t N, typename Count, typename Write>
+QuadrilateralSoA runTasks(const std::array<PolygonArray<N>, 4> &polygons, int threads, Count &&count, Write &&write) {
+  const auto tasks = splitTasks(polygons);
+  std::vector<KindCount> offsets(tasks.size());
+  KindCount size = {};
+  for (size_t idx = 0; idx < tasks.size(); ++idx) {
+    offsets[idx] = size;
+    const KindCount children = count(tasks[idx]);
+    for (size_t kind = 0; kind < size.size(); ++kind) {
+      size[kind] += children[kind];
+    }
+  }
+  QuadrilateralSoA quadrilaterals;
+  for (size_t kind = 0; kind < size.size(); ++kind) {
+    quadrilaterals[kind].resize(size[kind]);
+  }
+  parallel::forEach(tasks.size(), threads, [&](size_t idx) {
+    write(tasks[idx], quadrilaterals, offsets[idx]);
+  });
+  return quadrilaterals;
+}
+
+// Same with culling, the size of the output run(task) of each task is only known once it is done
+template <size_t N, typename Run>
+QuadrilateralSoA runTasks(const std::array<PolygonArray<N>, 4> &polygons, int threads, Run &&run) {
+  const auto tasks = splitTasks(polygons);
+  std::vector<QuadrilateralSoA> results(tasks.size());
+  parallel::forEach(tasks.size(), threads, [&](size_t idx) {
+    results[idx] = run(tasks[idx]);
+  });
+  std::vector<KindCount> offsets(tasks.size());
+  KindCount size = {};
+  for (size_t idx = 0; idx < tasks.size(); ++idx) {
+    offsets[idx] = size;
+    for (size_t kind = 0; kind < size.size(); ++kind) {
+      size[kind] += results[idx][kind].size();
+    }
+  }
+  QuadrilateralSoA quadrilaterals;
+  for (size_t kind = 0; kind < size.size(); ++kind) {
+    quadrilaterals[kind].resize(size[kind]);
+  }
+  parallel::forEach(tasks.size(), threads, [&](size_t idx) {
+    for (size_t kind = 0; kind < size.size(); ++kind) {
+      results[idx][kind].copyTo(quadrilaterals[kind], offsets[idx][kind]);
+    }
+  });
+  return quadrilaterals;
+}
+
+// firstLevel is the level of the input triangles, it is only used to record tile counts.
+inline QuadrilateralSoA deflateAndComplete(const TriangleSoA &triangles, int level, int threads = 1, const std::optional<Rectangle> &clip = {}, int firstLevel = 0) {
+  const stats::Timer timer("deflate");
+  std::optional<Rectangle> area;
+  if (clip) {
+    // final tiles stick out of their triangle by less than 2 final edges
+    area = expand(*clip, 2.f * longestEdge(triangles) / std::pow(inflation, static_cast<float>(level)));
+  }
+
+  int splitLevel = 0;
+  while (splitLevel < level && total(countAfterDeflation(countKinds(triangles), splitLevel)) < parallelMinTriangles) {
+    ++splitLevel;
+  }
+  const TriangleSoA coarse = area ? deflate(triangles, splitLevel, *area, firstLevel) : deflate(triangles, splitLevel, firstLevel);
+  const int remaining = level - splitLevel;
+
+  if (!area) {
+    return runTasks(
+        coarse, threads,
+        [&](const TriangleSoA &task) { return countAfterDeflation(countKinds(task), remaining); },
+        [&](const TriangleSoA &task, QuadrilateralSoA &output, const KindCount &offset) {
+          completeShape(deflate(task, remaining, firstLevel + splitLevel), output, offset);
+        });
+  }
+  return runTasks(coarse, threads, [&](const TriangleSoA &task) {
+    return completeShape(deflate(task, remaining, *area, firstLevel + splitLevel));
+  });
+}
+
+// Inset of the vertices of each kind of quadrilateral.
+// All quadrilaterals of a kind are the same shape up to a similarity, so the inset of a vertex P with
+// neighbours N1 and N2 is m / |v1 - v0| * (n1 * (N1 - P) + n2 * (N2 - P)) with constant weights n1, n2.
+// They are measured once on a reference tile of each kind with the scalar moveMargin.
+struct MarginWeights {
+  // neighbours of each vertex in the order used by moveMargin, the remaining vertex is the opposite one
+  static constexpr std::array<std::array<size_t, 3>, 4> neighbours = {{{1, 2, 3}, {3, 0, 2}, {0, 3, 1}, {2, 1, 0}}};
+  std::array<std::array<float, 2>, 4> weights;
+};
+
+inline const std::array<MarginWeights, 4> &marginWeights() {
+  static const std::array<MarginWeights, 4> table = [] {
+    std::array<MarginWeights, 4> table = {};
+    for (const auto &triangle : referenceTriangles()) {
+      const size_t kind = static_cast<size_t>(triangle.color);
+      const PenroseQuadrilateral quad = completeShape(triangle);
+      const float length = norm(quad.vertices[1] - quad.vertices[0]);
+      for (size_t v = 0; v < 4; ++v) {
+        const auto [n1, n2, opposite] = MarginWeights::neighbours[v];
+        const Point P = quad.vertices[v];
+        const Point e1 = quad.vertices[n1] - P;
+        const Point e2 = quad.vertices[n2] - P;
+        const Point offset = moveMargin(P, quad.vertices[n1], quad.vertices[n2], quad.vertices[opposite], length) - P;
+        // offset = w1 * e1 + w2 * e2 solved with the Cramer's rule
+        const float det = e1.x * e2.y - e1.y * e2.x;
+        table[kind].weights[v] = {(offset.x * e2.y - offset.y * e2.x) / det, (e1.x * offset.y - e1.y * offset.x) / det};
+      }
+    }
+    return table;
+  }();
+  return table;
+}
+
+inline void addMargin(QuadrilateralArray &quadrilaterals, TriangleKind kind, const float margin) {
+  const auto &weights = marginWeights()[static_cast<size_t>(kind)].weights;
+  simd::forEach(quadrilaterals.size(), [&](auto tag, size_t idx) {
+    using V = decltype(tag);
+    const std::array<PointPack<V>, 4> vertices = {quadrilaterals.load<V>(0, idx), quadrilaterals.load<V>(1, idx), quadrilaterals.load<V>(2, idx), quadrilaterals.load<V>(3, idx)};
+    // a single square root for the four vertices
+    const V scale = V::broadcast(margin) / norm(vertices[1] - vertices[0]);
+    const auto inset = [&](size_t v) {
+      const auto [n1, n2, opposite] = MarginWeights::neighbours[v];
+      const V w1 = V::broadcast(weights[v][0]) * scale;
+      const V w2 = V::broadcast(weights[v][1]) * scale;
+      return vertices[v] + (vertices[n1] - vertices[v]) * w1 + (vertices[n2] - vertices[v]) * w2;
+    };
+    quadrilaterals.store<V>(idx, inset(0), inset(1), inset(2), inset(3));
+  });
+}
+
+inline void addMargin(QuadrilateralSoA &quadrilaterals, const float margin) {
+  for (size_t kind = 0; kind < quadrilaterals.size(); ++kind) {
+    addMargin(quadrilaterals[kind], static_cast<TriangleKind>(kind), margin);
+  }
+}
+
+inline PenroseQuadrilateral addMargin(const PenroseQuadrilateral &quad, const float margin) {
+  const auto &weights = marginWeights()[static_cast<size_t>(quad.color)].weights;
+  const float scale = margin / norm(quad.vertices[1] - quad.vertices[0]);
+  const auto inset = [&](size_t v) {
+    const auto [n1, n2, opposite] = MarginWeights::neighbours[v];
+    const Point P = quad.vertices[v];
+    return P + (quad.vertices[n1] - P) * (weights[v][0] * scale) + (quad.vertices[n2] - P) * (weights[v][1] * scale);
+  };
+  return {quad.color, inset(0), inset(1), inset(2), inset(3), quad.flag};
+}
+
+inline std::vector<PenroseQuadrilateral> addMargin(std::span<const PenroseQuadrilateral> quadrilaterals, const float margin) {
+  const stats::Timer timer("addMargin");
   std::vector<PenroseQuadrilateral> newList;
-  for (const auto& quad : quadrilaterals) {
-    const Point A = quad.vertices[0];
-    const Point B = quad.vertices[1];
-    const Point C = quad.vertices[2];
-    const Point D = quad.vertices[3];
-    newList.emplace_back(quad.color, moveMargin(A, B, C, D, margin), moveMargin(B, D, A, C, margin), moveMargin(C, A, D, B, margin), moveMargin(D, C, B, A, margin), quad.flag);
+  newList.reserve(quadrilaterals.size());
+  for (const auto &quad : quadrilaterals) {
+    newList.push_back(addMargin(quad, margin));
   }
   return newList;
 }
 
-std::vector<PenroseQuadrilateral> deflateAndMerge(const std::vector<PenroseTriangle> &triangles, int level) {
-  std::vector<PenroseTriangle> tiling = deflate(triangles);
-  for (int l = 1; l < level; ++l) {
-    tiling = deflate(tiling);
+// Set of points where a point closer than tolerance to a given one is found in constant time.
+// Points are registered in the cell of a grid containing them, and cells are looked up in an open
+// addressing hash table. A point can only match in the cells covered by its tolerance disk, mostly its own cell.
+class PointSet {
+public:
+  static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+  PointSet(size_t capacityHint, float tolerance)
+      : cellSize(8.f * tolerance), tolerance(tolerance), toleranceSq(tolerance * tolerance) {
+    // at most half full, probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < 2 * capacityHint) {
+      capacity <<= 1;
+    }
+    mask = capacity - 1;
+    table.assign(capacity, {0, none});
+    points.reserve(capacityHint);
+  }
+
+  // Index of a point closer than tolerance to pt, none if there is no such point
+  uint32_t find(const Point &pt) const {
+    const int64_t ixMin = cellIndex(pt.x - tolerance);
+    const int64_t ixMax = cellIndex(pt.x + tolerance);
+    const int64_t iyMin = cellIndex(pt.y - tolerance);
+    const int64_t iyMax = cellIndex(pt.y + tolerance);
+    for (int64_t ix = ixMin; ix <= ixMax; ++ix) {
+      for (int64_t iy = iyMin; iy <= iyMax; ++iy) {
+        const uint64_t cell = cellKey(ix, iy);
+        for (size_t pos = cellHash(cell) & mask; table[pos].idx != none; pos = (pos + 1) & mask) {
+          if (table[pos].cell == cell && normSq(points[table[pos].idx] - pt) < toleranceSq) {
+            return table[pos].idx;
+          }
+        }
+      }
+    }
+    return none;
+  }
+
+  // Add pt and return its index, the table is expected to be large enough
+  uint32_t insert(const Point &pt) {
+    const uint64_t cell = cellKey(cellIndex(pt.x), cellIndex(pt.y));
+    size_t pos = cellHash(cell) & mask;
+    while (table[pos].idx != none) {
+      pos = (pos + 1) & mask;
+    }
+    table[pos] = {cell, static_cast<uint32_t>(points.size())};
+    points.push_back(pt);
+    return table[pos].idx;
+  }
+
+  std::vector<Point> &values() {
+    return points;
+  }
+
+private:
+  int64_t cellIndex(float coordinate) const {
+    return static_cast<int64_t>(std::floor(coordinate / cellSize));
+  }
+  static uint64_t cellKey(int64_t ix, int64_t iy) {
+    return (static_cast<uint64_t>(ix) << 32) ^ static_cast<uint64_t>(iy & 0xffffffff);
+  }
+  static uint64_t cellHash(uint64_t key) {
+    return rng::mix64(key);
+  }
+
+  struct Slot {
+    uint64_t cell;
+    uint32_t idx;
+  };
+  float cellSize;
+  float tolerance;
+  float toleranceSq;
+  size_t mask;
+  std::vector<Slot> table;
+  std::vector<Point> points;
+};
+
+inline float cross(const Point &pt1, const Point &pt2) {
+  return pt1.x * pt2.y - pt1.y * pt2.x;
+}
+
+// Remove quadrilaterals whose center is closer than tolerance to the center of a previous one,
+// the 2 halves of a tile are completed into the same quadrilateral. The quadrilateral completed
+// from the counterclockwise half is kept, like forEachTile, so both give the same vertices to the bit.
+// Centers are looked up in a PointSet, so it runs in linear time.
+// Return the number of removed duplicates.
+inline size_t removeDuplicates(std::vector<PenroseQuadrilateral> &quadrilaterals, float tolerance = std::sqrt(epsilon)) {
+  const stats::Timer timer("removeDuplicates");
+  PointSet centers(quadrilaterals.size(), tolerance);
+  size_t kept = 0;
+  for (size_t idx = 0; idx < quadrilaterals.size(); ++idx) {
+    const PenroseQuadrilateral &quad = quadrilaterals[idx];
+    const Point center = quad.center();
+    // points are numbered in insertion order, that is the index of the kept quadrilateral
+    if (const uint32_t first = centers.find(center); first != PointSet::none) {
+      if (cross(quad.vertices[1] - quad.vertices[0], quad.vertices[2] - quad.vertices[0]) > 0.f) {
+        quadrilaterals[first] = quad;
+      }
+      continue;
+    }
+    centers.insert(center);
+    if (kept != idx) {
+      quadrilaterals[kept] = quadrilaterals[idx];
+    }
+    ++kept;
   }
 
-  std::vector<PenroseQuadrilateral> quadTiling = completeShape(tiling);
+  const size_t duplicates = quadrilaterals.size() - kept;
+  quadrilaterals.erase(quadrilaterals.begin() + kept, quadrilaterals.end());
+  stats::add("duplicates", duplicates);
+  return duplicates;
+}
+
+inline std::vector<PenroseQuadrilateral> deflateAndMerge(const std::vector<PenroseTriangle> &triangles, int level, int threads = 1, const std::optional<Rectangle> &clip = {}, int firstLevel = 0) {
+  // at least one deflation is always done
+  std::vector<PenroseQuadrilateral> quadTiling = toQuadrilaterals(deflateAndComplete(toSoA(triangles), std::max(level, 1), threads, clip, firstLevel));
 
-  // remove duplicate
-  std::sort(quadTiling.begin(), quadTiling.end());
-  auto last = std::unique(quadTiling.begin(), quadTiling.end());
-  quadTiling.erase(last, quadTiling.end());
+  const size_t duplicates = removeDuplicates(quadTiling);
+  stats::add("tiles", quadTiling.size());
+  spdlog::debug("deflateAndMerge: {} tiles, {} duplicated halves merged", quadTiling.size(), duplicates);
 
   return quadTiling;
 }
 
-void setRandomFlag(std::vector<PenroseQuadrilateral> &quadrilaterals, int threshold = 5) {
+// Counter of a tile keyed by its center, its draws don't depend on the backend or the order that produced it
+inline uint32_t tileCounter(const PenroseQuadrilateral &quadrilateral) {
+  const Point center = quadrilateral.center();
+  return rng::positionCounter(center.x, center.y);
+}
+
+// Flip the flag of each tile when a draw in [0, 10] is below threshold.
+// The draw of a tile only depends on the generator and the tile center.
+template <typename PointT>
+void setRandomFlag(std::vector<BasicPenroseQuadrilateral<PointT>> &quadrilaterals, const rng::Generator &generator, int threshold = 5) {
+  const stats::Timer timer("setRandomFlag");
+  std::vector<uint8_t> keep(quadrilaterals.size());
+  rng::drawAtLeast(generator, 11, static_cast<uint32_t>(std::max(threshold, 0)), keep, [&](size_t idx) {
+    return tileCounter(quadrilaterals[idx]);
+  });
+  for (size_t idx = 0; idx < quadrilaterals.size(); ++idx) {
+    quadrilaterals[idx].flag = keep[idx] ? quadrilaterals[idx].flag : !quadrilaterals[idx].flag;
+  }
+}
+
+template <typename PointT>
+void setRandomFlag(std::vector<BasicPenroseQuadrilateral<PointT>> &quadrilaterals, int threshold = 5) {
   std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<> distrib(0, 10);
-  for (auto &quad : quadrilaterals) {
-    quad.flag = distrib(gen) >= threshold ? quad.flag : !quad.flag;
+  setRandomFlag(quadrilaterals, rng::Generator((static_cast<uint64_t>(rd()) << 32) | rd(), 0), threshold);
+}
+
+// Index of the coarse quadrilateral each fine quadrilateral was deflated from.
+// The first half of a fine tile lies inside one half of its parent, so its centroid is located
+// with a uniform grid over the coarse tiles.
+inline std::vector<uint32_t> findParents(const std::vector<PenroseQuadrilateral> &fine, const std::vector<PenroseQuadrilateral> &coarse) {
+  const stats::Timer timer("findParents");
+  std::vector<uint32_t> parents(fine.size(), 0);
+  if (coarse.empty()) {
+    return parents;
+  }
+
+  Rectangle bounds(coarse[0].vertices[0], coarse[0].vertices[0]);
+  float cellSize = 0.f;
+  for (const auto &quad : coarse) {
+    Rectangle box(quad.vertices[0], quad.vertices[0]);
+    for (const Point &pt : quad.vertices) {
+      box.min = Point(std::min(box.min.x, pt.x), std::min(box.min.y, pt.y));
+      box.max = Point(std::max(box.max.x, pt.x), std::max(box.max.y, pt.y));
+    }
+    bounds.min = Point(std::min(bounds.min.x, box.min.x), std::min(bounds.min.y, box.min.y));
+    bounds.max = Point(std::max(bounds.max.x, box.max.x), std::max(bounds.max.y, box.max.y));
+    cellSize = std::max({cellSize, box.max.x - box.min.x, box.max.y - box.min.y});
+  }
+  const size_t columns = static_cast<size_t>((bounds.max.x - bounds.min.x) / cellSize) + 1;
+  const size_t rows = static_cast<size_t>((bounds.max.y - bounds.min.y) / cellSize) + 1;
+  auto cellOf = [&](const Point &pt) {
+    const size_t x = std::min(columns - 1, static_cast<size_t>(std::max(0.f, (pt.x - bounds.min.x) / cellSize)));
+    const size_t y = std::min(rows - 1, static_cast<size_t>(std::max(0.f, (pt.y - bounds.min.y) / cellSize)));
+    return y * columns + x;
+  };
+
+  // coarse tiles are registered in the cell of their center, a point is searched in the 3x3 neighbour cells
+  std::vector<uint32_t> start(columns * rows + 1, 0);
+  for (const auto &quad : coarse) {
+    ++start[cellOf(quad.center()) + 1];
+  }
+  for (size_t cell = 1; cell < start.size(); ++cell) {
+    start[cell] += start[cell - 1];
+  }
+  std::vector<uint32_t> items(coarse.size());
+  std::vector<uint32_t> next(start.begin(), start.end() - 1);
+  for (size_t idx = 0; idx < coarse.size(); ++idx) {
+    items[next[cellOf(coarse[idx].center())]++] = static_cast<uint32_t>(idx);
+  }
+
+  auto inside = [](const Point &pt, const Point &A, const Point &B, const Point &C) {
+    auto side = [&](const Point &from, const Point &to) {
+      return (to.x - from.x) * (pt.y - from.y) - (to.y - from.y) * (pt.x - from.x);
+    };
+    const float ab = side(A, B), bc = side(B, C), ca = side(C, A);
+    return (ab >= 0.f && bc >= 0.f && ca >= 0.f) || (ab <= 0.f && bc <= 0.f && ca <= 0.f);
+  };
+
+  for (size_t idx = 0; idx < fine.size(); ++idx) {
+    const auto &v = fine[idx].vertices;
+    const Point centroid = (v[0] + v[1] + v[2]) / 3.f;
+    const size_t cell = cellOf(centroid);
+    const size_t cx = cell % columns;
+    const size_t cy = cell / columns;
+    // points lying on a border because of rounding fall back to the nearest center
+    float nearest = std::numeric_limits<float>::max();
+    bool found = false;
+    for (size_t y = cy > 0 ? cy - 1 : 0; !found && y <= std::min(rows - 1, cy + 1); ++y) {
+      for (size_t x = cx > 0 ? cx - 1 : 0; !found && x <= std::min(columns - 1, cx + 1); ++x) {
+        for (uint32_t item = start[y * columns + x]; !found && item < start[y * columns + x + 1]; ++item) {
+          const auto &c = coarse[items[item]].vertices;
+          const float distance = normSq(coarse[items[item]].center() - centroid);
+          found = inside(centroid, c[0], c[1], c[2]) || inside(centroid, c[3], c[1], c[2]);
+          if (found || distance < nearest) {
+            parents[idx] = items[item];
+            nearest = distance;
+          }
+        }
+      }
+    }
+  }
+  return parents;
+}
+
+// =================================================================================================
+// Mesh
+// Tiles of a merged tiling share their vertices and edges : vertices are stored once and tiles refer
+// to them by index. Each tile boundary is made of 4 half edges, the twin of a half edge is the
+// half edge of the neighbour tile along the same edge.
+
+struct Mesh {
+  static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+  struct HalfEdge {
+    uint32_t origin;
+    // none on the border of the tiling
+    uint32_t twin;
+  };
+
+  std::vector<Point> vertices;
+  // vertex indices of each tile, in the PenroseQuadrilateral vertex order
+  std::vector<std::array<uint32_t, 4>> tiles;
+  // half edges 4 * tile to 4 * tile + 3 go around tile in path order v0, v1, v3, v2
+  std::vector<HalfEdge> halfEdges;
+  // one half edge of each edge
+  std::vector<uint32_t> edges;
+
+  static uint32_t tile(uint32_t halfEdge) {
+    return halfEdge / 4;
+  }
+
+  static uint32_t next(uint32_t halfEdge) {
+    return halfEdge / 4 * 4 + (halfEdge + 1) % 4;
+  }
+
+  uint32_t target(uint32_t halfEdge) const {
+    return halfEdges[next(halfEdge)].origin;
+  }
+};
+
+// Vertices closer than tolerance are merged
+template <std::ranges::sized_range Range>
+Mesh buildMesh(const Range &quadrilaterals, float tolerance = std::sqrt(epsilon)) {
+  const stats::Timer timer("mesh");
+  Mesh mesh;
+  // a vertex is shared by 2 to 4 tiles on average
+  PointSet vertices(2 * quadrilaterals.size() + 16, tolerance);
+  mesh.tiles.reserve(quadrilaterals.size());
+  for (const auto &quad : quadrilaterals) {
+    std::array<uint32_t, 4> tile;
+    for (size_t v = 0; v < 4; ++v) {
+      tile[v] = vertices.find(quad.vertices[v]);
+      if (tile[v] == PointSet::none) {
+        tile[v] = vertices.insert(quad.vertices[v]);
+      }
+    }
+    mesh.tiles.push_back(tile);
+  }
+  mesh.vertices = std::move(vertices.values());
+
+  mesh.halfEdges.resize(4 * mesh.tiles.size());
+  for (size_t idx = 0; idx < mesh.tiles.size(); ++idx) {
+    const auto &tile = mesh.tiles[idx];
+    const std::array<uint32_t, 4> path = {tile[0], tile[1], tile[3], tile[2]};
+    for (size_t k = 0; k < 4; ++k) {
+      mesh.halfEdges[4 * idx + k] = {path[k], Mesh::none};
+    }
+  }
+
+  // tiles don't share the same winding, so twins are half edges with the same unordered vertex pair,
+  // they are searched among the few half edges bucketed on their lowest vertex
+  const auto lowest = [&](uint32_t he) {
+    return std::min(mesh.halfEdges[he].origin, mesh.target(he));
+  };
+  std::vector<uint32_t> start(mesh.vertices.size() + 1, 0);
+  for (uint32_t he = 0; he < mesh.halfEdges.size(); ++he) {
+    ++start[lowest(he) + 1];
+  }
+  for (size_t v = 1; v < start.size(); ++v) {
+    start[v] += start[v - 1];
+  }
+  std::vector<uint32_t> bucket(mesh.halfEdges.size());
+  std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+  for (uint32_t he = 0; he < mesh.halfEdges.size(); ++he) {
+    bucket[fill[lowest(he)]++] = he;
+  }
+  mesh.edges.reserve(mesh.halfEdges.size() / 2 + 1);
+  for (uint32_t he = 0; he < mesh.halfEdges.size(); ++he) {
+    const uint32_t low = lowest(he);
+    const uint32_t high = std::max(mesh.halfEdges[he].origin, mesh.target(he));
+    if (mesh.halfEdges[he].twin == Mesh::none) {
+      for (uint32_t item = start[low]; item < start[low + 1]; ++item) {
+        const uint32_t other = bucket[item];
+        if (other != he && mesh.halfEdges[other].twin == Mesh::none && std::max(mesh.halfEdges[other].origin, mesh.target(other)) == high) {
+          mesh.halfEdges[he].twin = other;
+          mesh.halfEdges[other].twin = he;
+          break;
+        }
+      }
+    }
+    if (mesh.halfEdges[he].twin == Mesh::none || he < mesh.halfEdges[he].twin) {
+      mesh.edges.push_back(he);
+    }
+  }
+  return mesh;
+}
+
+// Chain the edges of mesh in polylines of at most maxEdges edges, each edge belongs to exactly one polyline.
+// Polylines start preferably at vertices with an odd count of edges, so most vertices are crossed by
+// a polyline instead of ending several ones. Points of the polylines are written in points.
+inline std::vector<Polyline> chainEdges(const Mesh &mesh, std::vector<Point> &points, size_t maxEdges = 16) {
+  const stats::Timer timer("chainEdges");
+  // edges around each vertex
+  std::vector<uint32_t> start(mesh.vertices.size() + 1, 0);
+  for (uint32_t he : mesh.edges) {
+    ++start[mesh.halfEdges[he].origin + 1];
+    ++start[mesh.target(he) + 1];
+  }
+  for (size_t v = 1; v < start.size(); ++v) {
+    start[v] += start[v - 1];
+  }
+  std::vector<uint32_t> incident(start.back());
+  std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+  for (uint32_t edge = 0; edge < mesh.edges.size(); ++edge) {
+    incident[fill[mesh.halfEdges[mesh.edges[edge]].origin]++] = edge;
+    incident[fill[mesh.target(mesh.edges[edge])]++] = edge;
+  }
+
+  std::vector<uint8_t> used(mesh.edges.size(), 0);
+  // first edge around each vertex that may still be unused
+  std::vector<uint32_t> cursor(start.begin(), start.end() - 1);
+  auto nextEdge = [&](uint32_t vertex) {
+    while (cursor[vertex] < start[vertex + 1] && used[incident[cursor[vertex]]]) {
+      ++cursor[vertex];
+    }
+    return cursor[vertex] < start[vertex + 1] ? incident[cursor[vertex]] : Mesh::none;
+  };
+
+  std::vector<uint32_t> pointStart;
+  points.clear();
+  points.reserve(mesh.edges.size() + mesh.edges.size() / maxEdges + 16);
+  auto walk = [&](uint32_t vertex) {
+    pointStart.push_back(static_cast<uint32_t>(points.size()));
+    points.push_back(mesh.vertices[vertex]);
+    for (size_t count = 0; count < maxEdges; ++count) {
+      const uint32_t edge = nextEdge(vertex);
+      if (edge == Mesh::none) {
+        break;
+      }
+      used[edge] = 1;
+      const uint32_t he = mesh.edges[edge];
+      vertex = mesh.halfEdges[he].origin == vertex ? mesh.target(he) : mesh.halfEdges[he].origin;
+      points.push_back(mesh.vertices[vertex]);
+    }
+  };
+  for (uint32_t vertex = 0; vertex < mesh.vertices.size(); ++vertex) {
+    if ((start[vertex + 1] - start[vertex]) % 2 == 1 && nextEdge(vertex) != Mesh::none) {
+      walk(vertex);
+    }
+  }
+  for (uint32_t vertex = 0; vertex < mesh.vertices.size(); ++vertex) {
+    while (nextEdge(vertex) != Mesh::none) {
+      walk(vertex);
+    }
+  }
+  pointStart.push_back(static_cast<uint32_t>(points.size()));
+
+  std::vector<Polyline> polylines;
+  polylines.reserve(pointStart.size() - 1);
+  for (size_t idx = 0; idx + 1 < pointStart.size(); ++idx) {
+    polylines.push_back({std::span<const Point>(points.data() + pointStart[idx], pointStart[idx + 1] - pointStart[idx])});
+  }
+  return polylines;
+}
+
+// =================================================================================================
+// Depth first streaming
+// The substitution tree is walked depth first and final tiles are given to a consumer as soon as
+// they are produced, so the memory used is proportional to the level and not to the tile count.
+
+using Segment = std::pair<Point, Point>;
+
+inline float distance(const Point &pt, const Segment &segment) {
+  const Point direction = segment.second - segment.first;
+  const float along = std::clamp(scalar(pt - segment.first, direction) / normSq(direction), 0.f, 1.f);
+  return norm(pt - (segment.first + direction * along));
+}
+
+inline bool isOnSegment(const Point &pt, const Segment &segment) {
+  const Point direction = segment.second - segment.first;
+  const float length = norm(direction);
+  const float along = scalar(pt - segment.first, direction) / length;
+  return std::abs(cross(direction, pt - segment.first)) / length < epsilon && along > -epsilon && along < length + epsilon;
+}
+
+// Edges of the patch that are not shared by 2 of its triangles
+inline std::vector<Segment> patchBorder(const std::vector<PenroseTriangle> &triangles) {
+  std::vector<Segment> edges;
+  for (const auto &triangle : triangles) {
+    for (size_t v = 0; v < 3; ++v) {
+      edges.emplace_back(triangle.vertices[v], triangle.vertices[(v + 1) % 3]);
+    }
+  }
+  std::vector<Segment> border;
+  for (size_t idx = 0; idx < edges.size(); ++idx) {
+    const bool shared = std::any_of(edges.begin(), edges.end(), [&](const Segment &other) {
+      return &other != &edges[idx] && ((other.first == edges[idx].first && other.second == edges[idx].second) ||
+                                       (other.first == edges[idx].second && other.second == edges[idx].first));
+    });
+    if (!shared) {
+      border.push_back(edges[idx]);
+    }
+  }
+  return border;
+}
+
+// The 2 halves of a tile are mirror images along their B-C edge so they have opposite orientations,
+// only the counterclockwise half produces the tile. On the patch border the other half does not exist
+// and the triangle produces the tile whatever its orientation.
+inline bool isOnBorder(const Point &B, const Point &C, const std::vector<Segment> &border) {
+  return std::any_of(border.begin(), border.end(), [&](const Segment &segment) {
+    return isOnSegment(B, segment) && isOnSegment(C, segment);
+  });
+}
+
+inline bool isTileOwner(const PenroseTriangle &triangle, const std::vector<Segment> &border) {
+  const Point &A = triangle.vertices[0];
+  const Point &B = triangle.vertices[1];
+  const Point &C = triangle.vertices[2];
+  return cross(B - A, C - A) > 0.f || isOnBorder(B, C, border);
+}
+
+struct VisitAll {
+  bool operator()(PenroseTriangle &, int) const {
+    return true;
+  }
+};
+
+// Call visitor(triangle, depth) on each triangle before its deflation, the visitor can modify the
+// triangle and return false to skip its whole subtree. consumer(quad) is called once per final tile.
+// Subtrees outside clip are skipped and subtrees fully inside are not checked anymore.
+template <typename Visitor, typename Consumer>
+void forEachTile(const std::vector<PenroseTriangle> &triangles, int level, Visitor &&visitor, Consumer &&consumer, const std::optional<Rectangle> &clip = {}) {
+  // includes the time spent in the consumer
+  const stats::Timer timer("stream");
+  const std::vector<Segment> border = patchBorder(triangles);
+  std::optional<Rectangle> area;
+  if (clip) {
+    // final tiles stick out of their triangle by less than 2 final edges
+    area = expand(*clip, 2.f * longestEdge(toSoA(triangles)) / std::pow(inflation, static_cast<float>(level)));
+  }
+
+  struct Node {
+    PenroseTriangle triangle;
+    int depth;
+    bool inside;
+  };
+  // the stack never hold more than 2 siblings waiting per level plus the current branch
+  std::vector<Node> stack;
+  stack.reserve(triangles.size() + 2 * level + 3);
+  for (auto it = triangles.rbegin(); it != triangles.rend(); ++it) {
+    stack.push_back({*it, 0, !area});
+  }
+
+  std::vector<PenroseTriangle> children;
+  children.reserve(3);
+  while (!stack.empty()) {
+    auto [triangle, depth, inside] = stack.back();
+    stack.pop_back();
+    if (!inside) {
+      const Rectangle box = boundingBox(triangle);
+      if (!intersects(*area, box)) {
+        continue;
+      }
+      inside = contains(*area, box);
+    }
+    if (!visitor(triangle, depth)) {
+      continue;
+    }
+    if (depth == level) {
+      if (isTileOwner(triangle, border)) {
+        consumer(completeShape(triangle));
+      }
+      continue;
+    }
+    children.clear();
+    deflate(triangle, std::back_inserter(children));
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      stack.push_back({*it, depth + 1, inside});
+    }
+  }
+}
+
+template <typename Consumer>
+void forEachTile(const std::vector<PenroseTriangle> &triangles, int level, Consumer &&consumer) {
+  forEachTile(triangles, level, VisitAll{}, consumer);
+}
+
+// First tile of the tiling, enough to know the tile size without generating the whole tiling
+inline PenroseQuadrilateral firstTile(const std::vector<PenroseTriangle> &triangles, int level) {
+  PenroseTriangle triangle = triangles.at(0);
+  for (int l = 0; l < level; ++l) {
+    triangle = deflate(triangle)[0];
+  }
+  return completeShape(triangle);
+}
+
+// =================================================================================================
+// Whole tile deflation
+// A tile is deflated as its 2 halves : its counterclockwise half (A, B, C) and the mirrored one (D, B, C).
+// A child tile is written only by the tile holding its counterclockwise half, so each tile of the next
+// level is written exactly once, also when its 2 halves come from 2 different tiles, and no duplicate
+// has to be removed. Whether a child is counterclockwise only depends on its rule and on the orientation
+// of its parent half, so each kind of tile has a fixed list of children and their count is known in advance.
+
+struct TileChild {
+  // 0 : counterclockwise half (A, B, C), 1 : mirrored half (D, B, C)
+  size_t half;
+  RuleChild child;
+};
+
+using TileRules = std::array<std::vector<TileChild>, 4>;
+
+inline const TileRules &tileRules() {
+  static const TileRules table = [] {
+    TileRules table;
+    for (PenroseTriangle triangle : referenceTriangles()) {
+      auto &[A, B, C] = triangle.vertices;
+      if (cross(B - A, C - A) < 0.f) {
+        // mirror image of the reference, the roles of the vertices are unchanged
+        for (Point &pt : triangle.vertices) {
+          pt.x = -pt.x;
+        }
+      }
+      const std::array<std::array<Point, 3>, 2> halves = {{{A, B, C}, {mirror(A, B, C), B, C}}};
+      const auto addChildren = [&](const auto &rules) {
+        for (const auto &rule : rules) {
+          if (rule.kind != triangle.color) {
+            continue;
+          }
+          for (size_t half = 0; half < halves.size(); ++half) {
+            for (size_t c = 0; c < rule.count; ++c) {
+              const RuleChild &child = rule.children[c];
+              const Point P0 = childVertex(halves[half], child.vertices[0]);
+              const Point P1 = childVertex(halves[half], child.vertices[1]);
+              const Point P2 = childVertex(halves[half], child.vertices[2]);
+              if (cross(P1 - P0, P2 - P0) > 0.f) {
+                table[static_cast<size_t>(triangle.color)].push_back({half, child});
+              }
+            }
+          }
+        }
+      };
+      addChildren(KiteDart::rules);
+      addChildren(Rhombus::rules);
+    }
+    return table;
+  }();
+  return table;
+}
+
+inline KindCount countTilesAfterDeflation(KindCount count, int level) {
+  for (int l = 0; l < level; ++l) {
+    KindCount next = {};
+    for (size_t parent = 0; parent < count.size(); ++parent) {
+      for (const TileChild &tileChild : tileRules()[parent]) {
+        next[static_cast<size_t>(tileChild.child.kind)] += count[parent];
+      }
+    }
+    count = next;
+  }
+  return count;
+}
+
+// Deflate all tiles into output, output buckets capacity is expected to be already large enough
+inline void deflateTiles(const QuadrilateralSoA &tiles, QuadrilateralSoA &output) {
+  const KindCount count = countTilesAfterDeflation(countKinds(tiles), 1);
+  for (size_t kind = 0; kind < output.size(); ++kind) {
+    output[kind].resize(count[kind]);
+  }
+  // next free index in each output bucket
+  KindCount offset = {};
+  for (size_t kind = 0; kind < tiles.size(); ++kind) {
+    const QuadrilateralArray &in = tiles[kind];
+    for (const auto &[half, child] : tileRules()[kind]) {
+      QuadrilateralArray &out = output[static_cast<size_t>(child.kind)];
+      const size_t first = offset[static_cast<size_t>(child.kind)];
+      offset[static_cast<size_t>(child.kind)] += in.size();
+      simd::forEach(in.size(), [&](auto tag, size_t idx) {
+        using V = decltype(tag);
+        const std::array<PointPack<V>, 3> parent = {in.load<V>(half == 0 ? 0 : 3, idx), in.load<V>(1, idx), in.load<V>(2, idx)};
+        const auto A = childVertex(parent, child.vertices[0]);
+        const auto B = childVertex(parent, child.vertices[1]);
+        const auto C = childVertex(parent, child.vertices[2]);
+        out.store<V>(first + idx, A, B, C, mirror(A, B, C));
+      });
+      std::copy(in.flag.begin(), in.flag.end(), out.flag.begin() + first);
+    }
   }
 }
 
+// Deflate level times using 2 ping-pong buffers sized once from the tile counts.
+// firstLevel is the level of the input tiles, it is only used to record tile counts.
+inline QuadrilateralSoA deflateTiles(const QuadrilateralSoA &tiles, int level, int firstLevel = 0) {
+  if (level <= 0) {
+    return tiles;
+  }
+  const KindCount count = countKinds(tiles);
+  const KindCount last = countTilesAfterDeflation(count, level);
+  const KindCount previous = countTilesAfterDeflation(count, level - 1);
+  QuadrilateralSoA current;
+  QuadrilateralSoA next;
+  for (size_t kind = 0; kind < count.size(); ++kind) {
+    next[kind].reserve(last[kind]);
+    current[kind].reserve(std::max(count[kind], previous[kind]));
+  }
+  if (level % 2 == 0) {
+    std::swap(current, next);
+  }
+  for (size_t kind = 0; kind < count.size(); ++kind) {
+    current[kind].resize(count[kind]);
+    tiles[kind].copyTo(current[kind], 0);
+  }
 
+  for (int l = 0; l < level; ++l) {
+    deflateTiles(current, next);
+    std::swap(current, next);
+    if (stats::enabled()) {
+      stats::addTiles(firstLevel + l + 1, countKinds(current));
+    }
+  }
+  return current;
+}
+
+// Deflate level times and drop tiles whose final descendants are outside clip before their subdivision.
+// A descendant is not always inside its ancestor tile : its counterclockwise half can be in the mirrored half of
+// its parent, which is outside of the tile owning the parent. Descendants stay closer than inflation diameters of
+// the ancestor to it. Final tiles are dropped when they are outside clip.
+inline QuadrilateralSoA deflateTiles(const QuadrilateralSoA &tiles, int level, const Rectangle &clip, int firstLevel = 0) {
+  QuadrilateralSoA current = tiles;
+  QuadrilateralSoA next;
+  // the edges of a quadrilateral array include the diagonals A-D and B-C, the longest one is the diameter
+  float diameter = longestEdge(tiles);
+  for (int l = 0; l < level; ++l) {
+    if (cull(current, expand(clip, inflation * diameter))) {
+      return deflateTiles(current, level - l, firstLevel + l);
+    }
+    deflateTiles(current, next);
+    std::swap(current, next);
+    diameter /= inflation;
+    if (stats::enabled()) {
+      stats::addTiles(firstLevel + l + 1, countKinds(current));
+    }
+  }
+  cull(current, clip);
+  return current;
+}
+
+// Same split in independent tasks than deflateAndComplete
+inline QuadrilateralSoA deflateTiles(const QuadrilateralSoA &tiles, int level, int threads, const std::optional<Rectangle> &clip, int firstLevel = 0) {
+  const stats::Timer timer("deflateTiles");
+  int splitLevel = 0;
+  while (splitLevel < level && total(countTilesAfterDeflation(countKinds(tiles), splitLevel)) < parallelMinTriangles) {
+    ++splitLevel;
+  }
+  // the coarse tiles are not final, their descendants can still stick out of them
+  const float coarseDiameter = longestEdge(tiles) / std::pow(inflation, static_cast<float>(splitLevel));
+  const QuadrilateralSoA coarse = clip ? deflateTiles(tiles, splitLevel, expand(*clip, inflation * coarseDiameter), firstLevel) : deflateTiles(tiles, splitLevel, firstLevel);
+  const int remaining = level - splitLevel;
+
+  if (!clip) {
+    return runTasks(
+        coarse, threads,
+        [&](const QuadrilateralSoA &task) { return countTilesAfterDeflation(countKinds(task), remaining); },
+        [&](const QuadrilateralSoA &task, QuadrilateralSoA &output, const KindCount &offset) {
+          const QuadrilateralSoA result = deflateTiles(task, remaining, firstLevel + splitLevel);
+          for (size_t kind = 0; kind < result.size(); ++kind) {
+            result[kind].copyTo(output[kind], offset[kind]);
+          }
+        });
+  }
+  return runTasks(coarse, threads, [&](const QuadrilateralSoA &task) {
+    return deflateTiles(task, remaining, *clip, firstLevel + splitLevel);
+  });
+}
+
+// Tile owned by triangle (see isTileOwner), its first 3 vertices are its counterclockwise half
+inline PenroseQuadrilateral toTile(const PenroseTriangle &triangle) {
+  auto [A, B, C] = triangle.vertices;
+  if (cross(B - A, C - A) < 0.f) {
+    A = mirror(A, B, C);
+  }
+  return {triangle.color, A, B, C, mirror(A, B, C), triangle.flag};
+}
+
+// A tile farther than 2 diameters from the patch border is inside the patch. The children it produces stay
+// closer than their diameter to it, they are farther than 2 * inflation - 1 of their own diameters and so are
+// all its descendants : they can be deflated as whole tiles with the tile rules.
+inline bool isFarFromBorder(const PenroseQuadrilateral &tile, const std::vector<Segment> &border) {
+  const Point center = tile.center();
+  float radius = 0.f;
+  float diameter = 0.f;
+  for (size_t v = 0; v < 4; ++v) {
+    radius = std::max(radius, norm(tile.vertices[v] - center));
+    for (size_t w = 0; w < v; ++w) {
+      diameter = std::max(diameter, norm(tile.vertices[v] - tile.vertices[w]));
+    }
+  }
+  return std::all_of(border.begin(), border.end(), [&](const Segment &segment) {
+    return distance(center, segment) - radius > 2.f * diameter;
+  });
+}
+
+inline QuadrilateralSoA toSoA(const std::vector<PenroseQuadrilateral> &quadrilaterals) {
+  QuadrilateralSoA buckets;
+  for (const auto &quad : quadrilaterals) {
+    buckets[static_cast<size_t>(quad.color)].push_back(quad.vertices, quad.flag);
+  }
+  return buckets;
+}
+
+inline void append(QuadrilateralSoA &quadrilaterals, const QuadrilateralSoA &other) {
+  for (size_t kind = 0; kind < quadrilaterals.size(); ++kind) {
+    const size_t first = quadrilaterals[kind].size();
+    quadrilaterals[kind].resize(first + other[kind].size());
+    other[kind].copyTo(quadrilaterals[kind], first);
+  }
+}
+
+// Alternative to deflateAndMerge where each tile is produced once, so there is no duplicate to remove.
+// Tiles near the patch border are kept as their triangles inside the patch and deflated like forEachTile
+// does, the other tiles are moved to the whole tile deflation as soon as they are far enough from the border.
+inline std::vector<PenroseQuadrilateral> deflateTiles(const std::vector<PenroseTriangle> &triangles, int level, int threads = 1, const std::optional<Rectangle> &clip = {}, int firstLevel = 0) {
+  // at least one deflation is always done
+  level = std::max(level, 1);
+  const std::vector<Segment> border = patchBorder(triangles);
+  // tile diameter at the current level, descendants of a tile stay closer than inflation diameters to it
+  std::vector<PenroseQuadrilateral> tiles;
+  for (const auto &triangle : triangles) {
+    tiles.push_back(toTile(triangle));
+  }
+  float diameter = longestEdge(toSoA(tiles));
+
+  QuadrilateralSoA quadrilaterals;
+  std::vector<PenroseTriangle> current = triangles;
+  std::vector<PenroseTriangle> next;
+  for (int l = 0;; ++l) {
+    std::vector<PenroseQuadrilateral> far;
+    next.clear();
+    for (const auto &triangle : current) {
+      // the tile is produced by its other half
+      if (!isTileOwner(triangle, border)) {
+        continue;
+      }
+      const PenroseQuadrilateral tile = toTile(triangle);
+      if (clip && !intersects(expand(*clip, l == level ? 0.f : inflation * diameter), boundingBox(tile))) {
+        continue;
+      }
+      if (l == level || isFarFromBorder(tile, border)) {
+        far.push_back(tile);
+        continue;
+      }
+      deflate(triangle, std::back_inserter(next));
+      // the other half is outside of the patch when the B-C edge is on the border
+      const auto &[A, B, C] = triangle.vertices;
+      if (!isOnBorder(B, C, border)) {
+        deflate(PenroseTriangle(triangle.color, mirror(A, B, C), B, C, triangle.flag), std::back_inserter(next));
+      }
+    }
+    append(quadrilaterals, deflateTiles(toSoA(far), level - l, threads, clip, firstLevel + l));
+    if (l == level) {
+      break;
+    }
+    std::swap(current, next);
+    diameter /= inflation;
+  }
+
+  std::vector<PenroseQuadrilateral> quadTiling = toQuadrilaterals(quadrilaterals);
+  stats::add("tiles", quadTiling.size());
+  spdlog::debug("deflateTiles: {} tiles", quadTiling.size());
+  return quadTiling;
+}
+
+// =================================================================================================
+// Zoom animation
+// Deflating the sun and star patches twice and scaling them by goldenRatio^2 around their center gives
+// back the same tiling turned by pi. A zoom into the center is periodic : the frame at zoom
+// goldenRatio^(2c) * scale, with scale in [1, goldenRatio^2), shows the tiles of the frame at scale, turned
+// by pi when c is odd. Only the tiles of one cycle are deflated and every frame reuses them.
+
+struct ZoomCycle {
+  Point center;
+  std::vector<Segment> border;
+  // phases[j] holds the triangles of level + j seen from scale goldenRatio^j to goldenRatio^(j + 1),
+  // tiles are subdivided once they grow past goldenRatio times their size at scale 1
+  std::array<std::vector<PenroseTriangle>, 2> phases;
+  // final tiles stick out of their triangle by less than margins[j]
+  std::array<float, 2> margins;
+};
+
+// Position of a frame in the zoom cycle
+struct ZoomFrame {
+  size_t phase;
+  float scale;
+  bool turned;
+};
+
+// Part of the plane seen through view when the tiling is scaled by scale around center
+inline Rectangle zoomView(const Rectangle &view, const Point &center, float scale) {
+  return {center + (view.min - center) / scale, center + (view.max - center) / scale};
+}
+
+inline ZoomFrame zoomFrame(double zoom) {
+  const double cycleLength = 2. * std::log(static_cast<double>(goldenRatio));
+  const double cycle = std::floor(std::log(zoom) / cycleLength);
+  // the remainder is clamped against rounding at the cycle ends
+  const float scale = std::clamp(static_cast<float>(zoom / std::exp(cycle * cycleLength)), 1.f, goldenRatio * goldenRatio);
+  return {scale < goldenRatio ? size_t(0) : size_t(1), scale, std::fmod(std::abs(cycle), 2.) == 1.};
+}
+
+// Tiles of level seen through view during a zoom cycle into center, center must be the center of the sun or star patch
+inline ZoomCycle zoomCycle(const std::vector<PenroseTriangle> &triangles, int level, const Point &center, const Rectangle &view) {
+  const stats::Timer timer("zoomCycle");
+  ZoomCycle cycle{center, patchBorder(triangles), {}, {}};
+  const float edge = longestEdge(toSoA(triangles)) / std::pow(inflation, static_cast<float>(level));
+  cycle.margins = {2.f * edge, 2.f * edge / inflation};
+
+  cycle.phases[0] = toTriangles(deflate(toSoA(triangles), level, expand(view, cycle.margins[0])));
+  // the tiles leaving the view before the subdivision are not deflated
+  const Rectangle area = expand(zoomView(view, center, goldenRatio), cycle.margins[1]);
+  std::vector<PenroseTriangle> visible = cycle.phases[0];
+  std::erase_if(visible, [&](const PenroseTriangle &triangle) {
+    return !intersects(area, boundingBox(triangle));
+  });
+  cycle.phases[1] = toTriangles(deflate(toSoA(visible), 1, area, level));
+  spdlog::debug("zoomCycle: {} and {} triangles", cycle.phases[0].size(), cycle.phases[1].size());
+  return cycle;
+}
+
+// Call consumer(quad, key) on each tile seen through view at zoom, quad is in the frame coordinates and
+// key is the tile center in the cycle coordinates, it does not move while the tile is visible
+template <typename Consumer>
+void forEachZoomTile(const ZoomCycle &cycle, double zoom, const Rectangle &view, Consumer &&consumer) {
+  const ZoomFrame frame = zoomFrame(zoom);
+  const std::vector<PenroseTriangle> &triangles = cycle.phases[frame.phase];
+  const Rectangle area = expand(zoomView(view, cycle.center, frame.scale), cycle.margins[frame.phase]);
+  const float scale = frame.turned ? -frame.scale : frame.scale;
+  for (const auto &triangle : triangles) {
+    // tiles which left the view are skipped
+    if (!intersects(area, boundingBox(triangle)) || !isTileOwner(triangle, cycle.border)) {
+      continue;
+    }
+    PenroseQuadrilateral quad = completeShape(triangle);
+    const Point key = quad.center();
+    for (auto &vertex : quad.vertices) {
+      vertex = cycle.center + (vertex - cycle.center) * scale;
+    }
+    consumer(quad, key);
+  }
+}
 
-} // namespace penrose
\ No newline at end of file
+} // namespace penrose
@@ -0,0 +1,137 @@
+/*
+ *  https://github.com/edmBernard/bg-generation-penrose
+ *
+ *  Created by Erwan BERNARD on 11/09/2021.
+ *
+ *  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+ *  Distributed under the Apache License, Version 2.0. (See accompanying
+ *  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+ */
+
+#ifndef PENROSE_C_H
+#define PENROSE_C_H
+
+/* C interface of the penrose library. Tiles are written in memory owned by the caller and svg
+ * documents are streamed to a caller supplied buffer or write callback. Functions return a
+ * penrose_status, the message of the last error of the calling thread is given by penrose_last_error. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(PENROSE_SHARED)
+#if defined(PENROSE_BUILDING)
+#define PENROSE_API __declspec(dllexport)
+#else
+#define PENROSE_API __declspec(dllimport)
+#endif
+#elif defined(PENROSE_SHARED)
+#define PENROSE_API __attribute__((visibility("default")))
+#else
+#define PENROSE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum penrose_status {
+  PENROSE_OK = 0,
+  PENROSE_INVALID_ARGUMENT = 1,
+  /* the output did not fit, the size needed is returned */
+  PENROSE_BUFFER_TOO_SMALL = 2,
+  /* the write callback returned 0 */
+  PENROSE_WRITE_ERROR = 3,
+  PENROSE_ERROR = 4
+} penrose_status;
+
+/* Tiling covering a canvas, the same options than the command line */
+typedef struct penrose_options {
+  /* rhombs (P3) instead of kites and darts (P2) */
+  int rhombus;
+  int level;
+  /* canvas size in pixels */
+  int width;
+  int height;
+} penrose_options;
+
+/* Tile with its 4 vertices in canvas pixels. kind is 0 kite, 1 dart, 2 thin rhomb, 3 thick rhomb */
+typedef struct penrose_tile {
+  float x[4];
+  float y[4];
+  uint8_t kind;
+  uint8_t flag;
+  uint8_t padding[2];
+} penrose_tile;
+
+/* Number of tile shapes of a tiling, 4 kinds in 20 orientations */
+#define PENROSE_SHAPE_COUNT 80
+
+/* Tile packed in 12 bytes : its first vertex in canvas pixels, its kind and its orientation among the
+ * 10 edge directions of the tiling, times 2 plus 1 for mirrored tiles. Its 4 vertices are the first one
+ * plus the offsets of the shape kind * 20 + orientation given by penrose_tile_shapes. */
+typedef struct penrose_packed_tile {
+  float x;
+  float y;
+  uint8_t kind;
+  uint8_t orientation;
+  uint8_t flag;
+  uint8_t padding;
+} penrose_packed_tile;
+
+/* Vertices of the tiles of a kind and orientation relative to their first vertex */
+typedef struct penrose_tile_shape {
+  float x[4];
+  float y[4];
+} penrose_tile_shape;
+
+/* Styling of the single level wallpaper */
+typedef struct penrose_style {
+  /* holes in [0, 10], 0 for no holes */
+  int threshold;
+  /* draw only the tile borders */
+  int neon;
+  uint64_t seed;
+  /* decimals of the compact path encoding, negative for full coordinates */
+  int precision;
+} penrose_style;
+
+/* Receives the svg document chunk after chunk, returns 0 when the bytes cannot be written */
+typedef int (*penrose_write_fn)(void *context, const char *bytes, size_t size);
+
+PENROSE_API void penrose_default_options(penrose_options *options);
+PENROSE_API void penrose_default_style(penrose_style *style);
+
+/* Upper bound of the number of tiles written by penrose_generate, 0 for invalid options */
+PENROSE_API size_t penrose_max_tiles(const penrose_options *options);
+
+/* Write the tiles overlapping the canvas to tiles. count receives the number of tiles of the tiling,
+ * when it is above capacity only capacity tiles are written and PENROSE_BUFFER_TOO_SMALL is returned. */
+PENROSE_API penrose_status penrose_generate(const penrose_options *options, penrose_tile *tiles, size_t capacity, size_t *count);
+
+/* penrose_generate writing packed tiles, a third of the memory of penrose_tile */
+PENROSE_API penrose_status penrose_generate_packed(const penrose_options *options, penrose_packed_tile *tiles, size_t capacity, size_t *count);
+
+/* Offsets of the vertices of the packed tiles generated with options, shapes holds PENROSE_SHAPE_COUNT shapes */
+PENROSE_API penrose_status penrose_tile_shapes(const penrose_options *options, penrose_tile_shape *shapes);
+
+/* Svg document of tiles generated with options, streamed to write(context, bytes, size) */
+PENROSE_API penrose_status penrose_write_svg(const penrose_options *options, const penrose_tile *tiles, size_t count,
+                                             const penrose_style *style, penrose_write_fn write, void *context);
+
+/* penrose_write_svg of packed tiles */
+PENROSE_API penrose_status penrose_write_packed_svg(const penrose_options *options, const penrose_packed_tile *tiles, size_t count,
+                                                    const penrose_style *style, penrose_write_fn write, void *context);
+
+/* Svg document written to buffer. size receives the document size, when it is above capacity
+ * only capacity bytes are written and PENROSE_BUFFER_TOO_SMALL is returned. */
+PENROSE_API penrose_status penrose_write_svg_buffer(const penrose_options *options, const penrose_tile *tiles, size_t count,
+                                                    const penrose_style *style, char *buffer, size_t capacity, size_t *size);
+
+/* Message of the last error of the calling thread, empty when there was none */
+PENROSE_API const char *penrose_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PENROSE_C_H */
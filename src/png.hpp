@@ -0,0 +1,274 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(PENROSE_ZLIB)
+#include <zlib.h>
+#include <stdexcept>
+#endif
+
+namespace png {
+
+namespace details {
+
+// Bits are packed from the least significant bit of each byte as required by deflate
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<uint8_t> &out)
+      : out(out) {
+  }
+
+  void write(uint32_t bits, int count) {
+    buffer |= static_cast<uint64_t>(bits) << filled;
+    filled += count;
+    while (filled >= 8) {
+      out.push_back(static_cast<uint8_t>(buffer));
+      buffer >>= 8;
+      filled -= 8;
+    }
+  }
+
+  // Huffman codes are defined from their most significant bit
+  void writeCode(uint32_t code, int count) {
+    uint32_t reversed = 0;
+    for (int b = 0; b < count; ++b) {
+      reversed |= ((code >> b) & 1u) << (count - 1 - b);
+    }
+    write(reversed, count);
+  }
+
+  void flush() {
+    if (filled > 0) {
+      out.push_back(static_cast<uint8_t>(buffer));
+    }
+    buffer = 0;
+    filled = 0;
+  }
+
+private:
+  std::vector<uint8_t> &out;
+  uint64_t buffer = 0;
+  int filled = 0;
+};
+
+// Fixed Huffman code of a literal/length symbol
+inline void writeLiteral(BitWriter &writer, uint32_t symbol) {
+  if (symbol < 144) {
+    writer.writeCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.writeCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.writeCode(symbol - 256, 7);
+  } else {
+    writer.writeCode(0xC0 + symbol - 280, 8);
+  }
+}
+
+inline void writeMatch(BitWriter &writer, uint32_t length, uint32_t distance) {
+  static constexpr std::array<uint16_t, 29> lengthBase = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static constexpr std::array<uint8_t, 29> lengthExtra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static constexpr std::array<uint16_t, 30> distanceBase = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static constexpr std::array<uint8_t, 30> distanceExtra = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+  const size_t lengthCode = std::upper_bound(lengthBase.begin(), lengthBase.end(), length) - lengthBase.begin() - 1;
+  writeLiteral(writer, 257 + static_cast<uint32_t>(lengthCode));
+  writer.write(length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+  const size_t distanceCode = std::upper_bound(distanceBase.begin(), distanceBase.end(), distance) - distanceBase.begin() - 1;
+  writer.writeCode(static_cast<uint32_t>(distanceCode), 5);
+  writer.write(distance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+}
+
+} // namespace details
+
+// Raw deflate stream in a single block with the fixed Huffman codes.
+// Matches are found with hash chains over the 32 KiB window, which is enough for the large
+// flat areas of the rendered images.
+inline std::vector<uint8_t> deflate(const std::vector<uint8_t> &data) {
+  constexpr size_t windowSize = 1 << 15;
+  constexpr size_t hashSize = 1 << 15;
+  constexpr size_t minMatch = 3;
+  constexpr size_t maxMatch = 258;
+  constexpr int maxChain = 32;
+  constexpr int32_t none = -1;
+
+  std::vector<uint8_t> out;
+  out.reserve(data.size() / 4 + 64);
+  details::BitWriter writer(out);
+  // final block, fixed Huffman codes
+  writer.write(1, 1);
+  writer.write(1, 2);
+
+  std::vector<int32_t> head(hashSize, none);
+  std::vector<int32_t> previous(windowSize, none);
+  auto hash = [&](size_t pos) {
+    const uint32_t key = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+    return (key * 2654435761u) >> 17;
+  };
+  auto insert = [&](size_t pos) {
+    if (pos + minMatch <= data.size()) {
+      const uint32_t h = hash(pos);
+      previous[pos % windowSize] = head[h];
+      head[h] = static_cast<int32_t>(pos);
+    }
+  };
+
+  size_t pos = 0;
+  while (pos < data.size()) {
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+    if (pos + minMatch <= data.size()) {
+      const size_t limit = std::min(maxMatch, data.size() - pos);
+      int32_t candidate = head[hash(pos)];
+      for (int chain = 0; chain < maxChain && candidate != none && pos - candidate <= windowSize; ++chain) {
+        size_t length = 0;
+        while (length < limit && data[candidate + length] == data[pos + length]) {
+          ++length;
+        }
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = pos - candidate;
+          if (length == limit) {
+            break;
+          }
+        }
+        candidate = previous[candidate % windowSize];
+      }
+    }
+
+    if (bestLength >= minMatch) {
+      details::writeMatch(writer, static_cast<uint32_t>(bestLength), static_cast<uint32_t>(bestDistance));
+      for (size_t end = pos + bestLength; pos < end; ++pos) {
+        insert(pos);
+      }
+    } else {
+      details::writeLiteral(writer, data[pos]);
+      insert(pos);
+      ++pos;
+    }
+  }
+  // end of block
+  details::writeLiteral(writer, 256);
+  writer.flush();
+  return out;
+}
+
+inline uint32_t adler32(const std::vector<uint8_t> &data) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (size_t start = 0; start < data.size(); start += 5552) {
+    const size_t end = std::min(data.size(), start + 5552);
+    for (size_t idx = start; idx < end; ++idx) {
+      a += data[idx];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+inline uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> values;
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k) {
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      values[n] = c;
+    }
+    return values;
+  }();
+  crc = ~crc;
+  for (size_t idx = 0; idx < size; ++idx) {
+    crc = table[(crc ^ data[idx]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// zlib stream, compressed with zlib when available otherwise with the built-in encoder
+inline std::vector<uint8_t> compress(const std::vector<uint8_t> &data) {
+#if defined(PENROSE_ZLIB)
+  uLongf size = compressBound(static_cast<uLong>(data.size()));
+  std::vector<uint8_t> out(size);
+  if (compress2(out.data(), &size, data.data(), static_cast<uLong>(data.size()), Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw std::runtime_error("zlib compression failed");
+  }
+  out.resize(size);
+  return out;
+#else
+  std::vector<uint8_t> out = {0x78, 0x01};
+  const std::vector<uint8_t> deflated = deflate(data);
+  out.insert(out.end(), deflated.begin(), deflated.end());
+  const uint32_t checksum = adler32(data);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<uint8_t>(checksum >> shift));
+  }
+  return out;
+#endif
+}
+
+// PNG file content of an 8 bits RGB image, rgb holds height rows of width pixels
+inline std::vector<uint8_t> encode(size_t width, size_t height, const std::vector<uint8_t> &rgb) {
+  // each row is prefixed by its filter, "Sub" turns flat areas into runs of zeros
+  std::vector<uint8_t> filtered;
+  filtered.reserve(height * (1 + 3 * width));
+  for (size_t y = 0; y < height; ++y) {
+    const uint8_t *row = rgb.data() + y * 3 * width;
+    filtered.push_back(1);
+    for (size_t x = 0; x < 3 * width; ++x) {
+      filtered.push_back(static_cast<uint8_t>(row[x] - (x >= 3 ? row[x - 3] : 0)));
+    }
+  }
+
+  std::vector<uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  auto appendUint32 = [](std::vector<uint8_t> &bytes, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      bytes.push_back(static_cast<uint8_t>(value >> shift));
+    }
+  };
+  auto appendChunk = [&](const char *type, const std::vector<uint8_t> &content) {
+    appendUint32(file, static_cast<uint32_t>(content.size()));
+    const size_t start = file.size();
+    file.insert(file.end(), type, type + 4);
+    file.insert(file.end(), content.begin(), content.end());
+    appendUint32(file, crc32(file.data() + start, file.size() - start));
+  };
+
+  std::vector<uint8_t> header;
+  appendUint32(header, static_cast<uint32_t>(width));
+  appendUint32(header, static_cast<uint32_t>(height));
+  // 8 bits per channel, RGB, deflate, adaptive filtering, no interlace
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+  appendChunk("IHDR", header);
+  appendChunk("IDAT", compress(filtered));
+  appendChunk("IEND", {});
+  return file;
+}
+
+// Binary PPM (P6) file content of an 8 bits RGB image
+inline std::vector<uint8_t> encodePPM(size_t width, size_t height, const std::vector<uint8_t> &rgb) {
+  const std::string header = fmt::format("P6\n{} {}\n255\n", width, height);
+  std::vector<uint8_t> file(header.begin(), header.end());
+  file.insert(file.end(), rgb.begin(), rgb.end());
+  return file;
+}
+
+} // namespace png
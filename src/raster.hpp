@@ -0,0 +1,606 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <parallel.hpp>
+#include <png.hpp>
+#include <save.hpp>
+#include <stats.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace raster {
+
+using svg::Fill;
+using svg::RGB;
+using svg::StrokesStyle;
+using svg::Style;
+
+namespace details {
+
+// Pixels are covered by 4x4 samples, the coverage of a pixel is stored as a 16 bits mask.
+// Polygons of the same path are merged with a bitwise or, so shared edges are neither
+// darkened nor left with a seam, exactly like a single svg path.
+constexpr int samplesPerSide = 4;
+constexpr int samplesPerPixel = samplesPerSide * samplesPerSide;
+
+// sample positions inside a pixel, on a regular grid
+constexpr std::array<float, samplesPerPixel> sampleX = [] {
+  std::array<float, samplesPerPixel> values = {};
+  for (int sample = 0; sample < samplesPerPixel; ++sample) {
+    values[sample] = ((sample % samplesPerSide) + 0.5f) / samplesPerSide;
+  }
+  return values;
+}();
+constexpr std::array<float, samplesPerPixel> sampleY = [] {
+  std::array<float, samplesPerPixel> values = {};
+  for (int sample = 0; sample < samplesPerPixel; ++sample) {
+    values[sample] = ((sample / samplesPerSide) + 0.5f) / samplesPerSide;
+  }
+  return values;
+}();
+
+// Path vertices in the same order than svg::details::to_path, triangles are left open
+inline std::array<Point, 3> to_path(const Triangle &tr) {
+  return {tr.vertices[2], tr.vertices[0], tr.vertices[1]};
+}
+inline std::array<Point, 4> to_path(const Quadrilateral &tr) {
+  return {tr.vertices[0], tr.vertices[1], tr.vertices[3], tr.vertices[2]};
+}
+inline std::span<const Point> to_path(const Polyline &line) {
+  return line.points;
+}
+
+// Only quadrilaterals are closed paths
+template <typename T>
+bool isClosed(const T &) {
+  return std::is_base_of_v<Quadrilateral, std::remove_cvref_t<T>>;
+}
+
+struct Mask {
+  int x0;
+  int y0;
+  int size;
+  std::vector<uint16_t> bits;
+  // region modified since the last clear
+  int minX, minY, maxX, maxY;
+
+  Mask(int size)
+      : x0(0), y0(0), size(size), bits(size * size, 0) {
+    reset();
+  }
+
+  void reset() {
+    minX = minY = size;
+    maxX = maxY = -1;
+  }
+
+  void clear() {
+    for (int y = minY; y <= maxY; ++y) {
+      std::fill_n(bits.begin() + y * size + minX, maxX - minX + 1, uint16_t(0));
+    }
+    reset();
+  }
+};
+
+// Add the samples of triangle ABC to mask, samples on the edges are inside
+inline void rasterize(Point A, Point B, Point C, Mask &mask) {
+  const float area = penrose::cross(B - A, C - A);
+  if (area == 0.f) {
+    return;
+  }
+  if (area < 0.f) {
+    std::swap(B, C);
+  }
+  const int xStart = std::max(0, static_cast<int>(std::floor(std::min({A.x, B.x, C.x}))) - mask.x0);
+  const int yStart = std::max(0, static_cast<int>(std::floor(std::min({A.y, B.y, C.y}))) - mask.y0);
+  const int xEnd = std::min(mask.size - 1, static_cast<int>(std::floor(std::max({A.x, B.x, C.x}))) - mask.x0);
+  const int yEnd = std::min(mask.size - 1, static_cast<int>(std::floor(std::max({A.y, B.y, C.y}))) - mask.y0);
+  if (xStart > xEnd || yStart > yEnd) {
+    return;
+  }
+
+  // edge functions e(x, y) = a x + b y + c, positive inside, in pixel coordinates relative to the mask
+  struct Edge {
+    float a, b, c;
+    // value at each sample relative to the pixel corner
+    std::array<float, samplesPerPixel> offsets;
+  };
+  std::array<Edge, 3> edges;
+  const std::array<Point, 3> v = {A, B, C};
+  for (size_t e = 0; e < 3; ++e) {
+    const Point p = v[e] - Point(static_cast<float>(mask.x0), static_cast<float>(mask.y0));
+    const Point d = v[(e + 1) % 3] - v[e];
+    Edge &edge = edges[e];
+    edge = {-d.y, d.x, d.y * p.x - d.x * p.y, {}};
+    for (int sample = 0; sample < samplesPerPixel; ++sample) {
+      edge.offsets[sample] = edge.a * sampleX[sample] + edge.b * sampleY[sample];
+    }
+  }
+
+  for (int y = yStart; y <= yEnd; ++y) {
+    for (int x = xStart; x <= xEnd; ++x) {
+      // bounds of each edge function over the pixel square decide most pixels without sampling
+      std::array<float, 3> corners;
+      bool full = true;
+      bool empty = false;
+      for (size_t e = 0; e < 3; ++e) {
+        const Edge &edge = edges[e];
+        corners[e] = edge.a * x + edge.b * y + edge.c;
+        full &= corners[e] + std::min(edge.a, 0.f) + std::min(edge.b, 0.f) >= 0.f;
+        empty |= corners[e] + std::max(edge.a, 0.f) + std::max(edge.b, 0.f) < 0.f;
+      }
+      if (empty) {
+        continue;
+      }
+      uint16_t bits = 0xFFFF;
+      if (!full) {
+        bits = 0;
+        for (int sample = 0; sample < samplesPerPixel; ++sample) {
+          const bool inside = (corners[0] + edges[0].offsets[sample] >= 0.f) & (corners[1] + edges[1].offsets[sample] >= 0.f) & (corners[2] + edges[2].offsets[sample] >= 0.f);
+          bits |= static_cast<uint16_t>(inside << sample);
+        }
+        if (bits == 0) {
+          continue;
+        }
+      }
+      mask.bits[y * mask.size + x] |= bits;
+      mask.minX = std::min(mask.minX, x);
+      mask.maxX = std::max(mask.maxX, x);
+      mask.minY = std::min(mask.minY, y);
+      mask.maxY = std::max(mask.maxY, y);
+    }
+  }
+}
+
+// Fill triangles of a path polygon. Tiles are split along their v1 v2 diagonal, which is the
+// common edge of their 2 Robinson triangles, so darts are also covered correctly.
+template <typename Emit>
+void fillTriangles(std::span<const Point> pts, Emit &&emit) {
+  if (pts.size() == 3) {
+    emit(pts[0], pts[1], pts[2]);
+  } else {
+    emit(pts[0], pts[1], pts[3]);
+    emit(pts[1], pts[2], pts[3]);
+  }
+}
+
+// Stroke triangles of a path polygon : a rectangle per segment, butt caps at the ends of open
+// paths and miter joins with svg default miter limit of 4
+template <typename Emit>
+void strokeTriangles(std::span<const Point> pts, bool closed, float width, Emit &&emit) {
+  const float half = width / 2.f;
+  const size_t count = pts.size();
+  const size_t segments = closed ? count : count - 1;
+  auto normal = [&](size_t segment) {
+    const Point d = pts[(segment + 1) % count] - pts[segment];
+    const float length = norm(d);
+    return length > 0.f ? Point(-d.y / length, d.x / length) : Point(0, 0);
+  };
+
+  for (size_t s = 0; s < segments; ++s) {
+    const Point n = half * normal(s);
+    const Point &A = pts[s];
+    const Point &B = pts[(s + 1) % count];
+    emit(A + n, B + n, B - n);
+    emit(A + n, B - n, A - n);
+  }
+
+  for (size_t s = closed ? 0 : 1; s < segments; ++s) {
+    // join at the start of segment s
+    const size_t incoming = (s + segments - 1) % segments;
+    const Point n1 = normal(incoming);
+    const Point n2 = normal(s);
+    const float turn = penrose::cross(n1, n2);
+    if (turn == 0.f) {
+      continue;
+    }
+    // the join is on the outer side of the turn
+    const float side = turn > 0.f ? -half : half;
+    const Point &P = pts[s];
+    const Point P1 = P + side * n1;
+    const Point P2 = P + side * n2;
+    const float cosTurn = n1.x * n2.x + n1.y * n2.y;
+    // miter length / stroke width = 1 / sin(angle / 2) > 4
+    if ((1.f + cosTurn) / 2.f < 1.f / 16.f) {
+      emit(P, P1, P2);
+    } else {
+      const Point tip = P + (side / (1.f + cosTurn)) * (n1 + n2);
+      emit(P, P1, tip);
+      emit(P, tip, P2);
+    }
+  }
+}
+
+} // namespace details
+
+// Raster version of svg::Document : polygons are recorded with their style, in temporary files
+// once a path is large, and rasterized with anti-aliasing when the image is saved. Paths are
+// painted one after the other, the canvas is split in square screen tiles, polygons are binned
+// per tile and tiles are rendered in parallel. The canvas is rendered in bands of tile rows, so
+// the float colors and the coverage masks are only kept for the current band.
+class Document {
+public:
+  static constexpr int tileSize = 64;
+  // pixels of a band, its colors take 12 bytes per pixel
+  static constexpr size_t bandPixels = 1 << 20;
+
+  Document(size_t canvasSize, RGB background, int threads = 0)
+      : Document(Rectangle(Point(0, 0), Point(canvasSize, canvasSize)), background, threads) {
+  }
+
+  // Image of the view part of the plane, the view is rounded to whole pixels
+  Document(const Rectangle &view, RGB background, int threads = 0)
+      : x0(static_cast<int>(std::lround(view.min.x))), y0(static_cast<int>(std::lround(view.min.y))),
+        width(static_cast<int>(std::lround(view.max.x)) - x0), height(static_cast<int>(std::lround(view.max.y)) - y0),
+        background(background), threads(threads) {
+  }
+
+  Document(const Document &) = delete;
+  Document &operator=(const Document &) = delete;
+
+  ~Document() {
+    if (file) {
+      std::fclose(file);
+    }
+  }
+
+  // Check early that the output can be written, the image is only encoded in save
+  bool open(const std::string &filename) {
+    file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+      spdlog::error("Cannot open output file : {}.", filename);
+      return false;
+    }
+    return true;
+  }
+
+  template <std::ranges::random_access_range Range, typename Filter = svg::details::AcceptAll>
+  void addPolygon(const Range &polygons, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle, Filter &&filter = {}) {
+    Path &path = beginPath(paths, color, strokeStyle);
+    for (size_t idx = 0; idx < std::ranges::size(polygons); ++idx) {
+      const auto &polygon = polygons[idx];
+      bool accepted;
+      if constexpr (std::is_invocable_v<Filter, decltype(polygon), size_t>) {
+        accepted = filter(polygon, idx);
+      } else {
+        accepted = filter(polygon);
+      }
+      if (accepted) {
+        path.add(polygon);
+      }
+    }
+  }
+
+  template <typename T>
+  requires(!std::ranges::range<T>)
+  void addPolygon(const T &polygon, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle) {
+    addPolygon(std::span<const T>(&polygon, 1), color, strokeStyle);
+  }
+
+  // Same as svg::Document::addPolygons, classify(polygon, idx) return a bit mask of styles
+  template <std::ranges::random_access_range Range, typename Classify>
+  void addPolygons(const Range &polygons, const std::vector<Style> &styles, Classify &&classify) {
+    const size_t first = paths.size();
+    for (const auto &style : styles) {
+      beginPath(paths, style.first, style.second);
+    }
+    for (size_t idx = 0; idx < std::ranges::size(polygons); ++idx) {
+      const uint32_t mask = classify(polygons[idx], idx);
+      for (size_t style = 0; style < styles.size(); ++style) {
+        if (mask & (1u << style)) {
+          paths[first + style].add(polygons[idx]);
+        }
+      }
+    }
+  }
+
+  // Layers are drawn after the polygons given to addPolygon, like in svg::Document
+  size_t addLayer(std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle) {
+    beginPath(layers, color, strokeStyle);
+    return layers.size() - 1;
+  }
+
+  template <typename T>
+  void addToLayer(size_t layer, const T &polygon) {
+    layers[layer].add(polygon);
+  }
+
+  // RGB pixels, row by row
+  std::vector<uint8_t> render() {
+    const stats::Timer timer("raster");
+    const int tilesPerRow = (width + tileSize - 1) / tileSize;
+    const int tilesPerColumn = (height + tileSize - 1) / tileSize;
+    const int bandRows = std::clamp(static_cast<int>(bandPixels / (static_cast<size_t>(tilesPerRow) * tileSize * tileSize)), 1, tilesPerColumn);
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 3);
+    for (int firstRow = 0; firstRow < tilesPerColumn; firstRow += bandRows) {
+      renderBand(pixels, tilesPerRow, firstRow, std::min(bandRows, tilesPerColumn - firstRow));
+    }
+    return pixels;
+  }
+
+  // Rendered image encoded in PNG or in PPM
+  std::vector<uint8_t> getContent(bool ppm = false) {
+    const std::vector<uint8_t> pixels = render();
+    std::vector<uint8_t> content;
+    {
+      const stats::Timer timer("encode");
+      content = ppm ? png::encodePPM(width, height, pixels) : png::encode(width, height, pixels);
+    }
+    stats::add("image.bytes", content.size());
+    return content;
+  }
+
+  // Render and write the image, in PPM when filename ends with .ppm otherwise in PNG
+  bool save(const std::string &filename) {
+    if (!file && !open(filename)) {
+      return false;
+    }
+    const std::vector<uint8_t> content = getContent(filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0);
+    const bool ok = std::fwrite(content.data(), 1, content.size(), file) == content.size() && std::fclose(file) == 0;
+    file = nullptr;
+    if (!ok) {
+      spdlog::error("Cannot write output file : {}.", filename);
+    }
+    return ok;
+  }
+
+private:
+  // Polygons in svg path order
+  struct Polygons {
+    std::vector<Point> points;
+    std::vector<uint32_t> start = {0};
+    std::vector<uint8_t> closed;
+
+    template <typename T>
+    void add(const T &polygon) {
+      const auto pts = details::to_path(polygon);
+      points.insert(points.end(), pts.begin(), pts.end());
+      start.push_back(static_cast<uint32_t>(points.size()));
+      closed.push_back(details::isClosed(polygon));
+    }
+
+    std::span<const Point> polygon(size_t idx) const {
+      return {points.data() + start[idx], start[idx + 1] - start[idx]};
+    }
+
+    size_t size() const {
+      return closed.size();
+    }
+
+    void clear() {
+      points.clear();
+      start.assign(1, 0);
+      closed.clear();
+    }
+  };
+
+  // Polygons of a path with their style. Full chunks of polygons are moved to a temporary file,
+  // so the memory used does not depend on the number of polygons.
+  struct Path {
+    static constexpr size_t chunkPoints = 1 << 18;
+
+    std::optional<Fill> fill;
+    std::optional<StrokesStyle> stroke;
+    Polygons pending;
+    std::optional<svg::details::TempFile> spill;
+
+    template <typename T>
+    void add(const T &polygon) {
+      pending.add(polygon);
+      if (pending.points.size() >= chunkPoints) {
+        if (!spill) {
+          spill.emplace();
+        }
+        const std::array<uint32_t, 2> sizes = {static_cast<uint32_t>(pending.size()), static_cast<uint32_t>(pending.points.size())};
+        spill->write(sizes.data(), sizeof(sizes));
+        spill->write(pending.start.data(), pending.start.size() * sizeof(uint32_t));
+        spill->write(pending.closed.data(), pending.closed.size());
+        spill->write(pending.points.data(), pending.points.size() * sizeof(Point));
+        pending.clear();
+      }
+    }
+
+    // Call function(polygons) on the chunks of polygons in path order
+    template <typename Function>
+    void forEachChunk(Function &&function) {
+      if (spill) {
+        spill->rewind();
+        Polygons chunk;
+        for (size_t read = 0; read < spill->size();) {
+          std::array<uint32_t, 2> sizes;
+          spill->read(sizes.data(), sizeof(sizes));
+          chunk.start.resize(sizes[0] + 1);
+          chunk.closed.resize(sizes[0]);
+          chunk.points.resize(sizes[1], Point(0, 0));
+          spill->read(chunk.start.data(), chunk.start.size() * sizeof(uint32_t));
+          spill->read(chunk.closed.data(), chunk.closed.size());
+          spill->read(chunk.points.data(), chunk.points.size() * sizeof(Point));
+          read += sizeof(sizes) + chunk.start.size() * sizeof(uint32_t) + chunk.closed.size() + chunk.points.size() * sizeof(Point);
+          function(static_cast<const Polygons &>(chunk));
+        }
+      }
+      if (pending.size() > 0) {
+        function(static_cast<const Polygons &>(pending));
+      }
+    }
+  };
+
+  // Polygon indices of each screen tile, start[tile] to start[tile + 1] in items
+  struct Bins {
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> items;
+  };
+
+  // Paint all the paths on the tile rows firstRow to firstRow + rows, then write their pixels
+  void renderBand(std::vector<uint8_t> &pixels, int tilesPerRow, int firstRow, int rows) {
+    const size_t tileCount = static_cast<size_t>(tilesPerRow) * rows;
+
+    // color and coverage of each screen tile of the band, the masks are in plane coordinates
+    std::vector<std::vector<std::array<float, 3>>> colors(tileCount);
+    std::vector<details::Mask> masks;
+    masks.reserve(tileCount);
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+      colors[tile].assign(tileSize * tileSize, {float(background.r), float(background.g), float(background.b)});
+      masks.emplace_back(tileSize);
+      masks.back().x0 = x0 + static_cast<int>(tile % tilesPerRow) * tileSize;
+      masks.back().y0 = y0 + (firstRow + static_cast<int>(tile / tilesPerRow)) * tileSize;
+    }
+
+    // Polygons of a path are merged in the masks chunk after chunk, then the masks are composited with rgb
+    auto paint = [&](Path &path, float extent, const RGB &rgb, auto &&triangles) {
+      path.forEachChunk([&](const Polygons &polygons) {
+        const Bins bins = binPolygons(polygons, extent, tilesPerRow, firstRow, rows);
+        parallel::forEach(tileCount, threads, [&](size_t tile) {
+          auto emit = [&](const Point &A, const Point &B, const Point &C) {
+            details::rasterize(A, B, C, masks[tile]);
+          };
+          for (uint32_t idx = bins.start[tile]; idx < bins.start[tile + 1]; ++idx) {
+            triangles(polygons, bins.items[idx], emit);
+          }
+        });
+      });
+      parallel::forEach(tileCount, threads, [&](size_t tile) {
+        details::Mask &mask = masks[tile];
+        if (mask.maxX < 0) {
+          return;
+        }
+        for (int y = mask.minY; y <= mask.maxY; ++y) {
+          for (int x = mask.minX; x <= mask.maxX; ++x) {
+            const uint16_t bits = mask.bits[y * tileSize + x];
+            if (bits) {
+              const float coverage = std::popcount(bits) / static_cast<float>(details::samplesPerPixel);
+              auto &c = colors[tile][y * tileSize + x];
+              c[0] += (rgb.r - c[0]) * coverage;
+              c[1] += (rgb.g - c[1]) * coverage;
+              c[2] += (rgb.b - c[2]) * coverage;
+            }
+          }
+        }
+        mask.clear();
+      });
+    };
+
+    for (auto *list : {&paths, &layers}) {
+      for (Path &path : *list) {
+        // like svg, the fill is painted before the stroke
+        if (path.fill) {
+          paint(path, 0.f, path.fill->color, [](const Polygons &polygons, uint32_t idx, auto &emit) {
+            details::fillTriangles(polygons.polygon(idx), emit);
+          });
+        }
+        if (path.stroke) {
+          const float width = path.stroke->width;
+          paint(path, 2.f * width, path.stroke->color, [width](const Polygons &polygons, uint32_t idx, auto &emit) {
+            details::strokeTriangles(polygons.polygon(idx), polygons.closed[idx], width, emit);
+          });
+        }
+      }
+    }
+
+    parallel::forEach(tileCount, threads, [&](size_t tile) {
+      const int tileX = static_cast<int>(tile % tilesPerRow) * tileSize;
+      const int tileY = (firstRow + static_cast<int>(tile / tilesPerRow)) * tileSize;
+      const int tileWidth = std::min(tileSize, width - tileX);
+      const int tileHeight = std::min(tileSize, height - tileY);
+      for (int y = 0; y < tileHeight; ++y) {
+        for (int x = 0; x < tileWidth; ++x) {
+          const auto &c = colors[tile][y * tileSize + x];
+          uint8_t *pixel = pixels.data() + (static_cast<size_t>(tileY + y) * width + tileX + x) * 3;
+          for (size_t channel = 0; channel < 3; ++channel) {
+            pixel[channel] = static_cast<uint8_t>(std::clamp(std::lround(c[channel]), 0l, 255l));
+          }
+        }
+      }
+    });
+  }
+
+  Path &beginPath(std::vector<Path> &list, const std::optional<Fill> &color, const std::optional<StrokesStyle> &strokeStyle) {
+    list.emplace_back();
+    list.back().fill = color;
+    list.back().stroke = strokeStyle;
+    return list.back();
+  }
+
+  // Counting sort of the polygons by tile of the rows firstRow to firstRow + rows, using their bounding
+  // box enlarged by extent for the stroke miters
+  Bins binPolygons(const Polygons &path, float extent, int tilesPerRow, int firstRow, int rows) const {
+    Bins bins;
+    bins.start.assign(static_cast<size_t>(tilesPerRow) * rows + 1, 0);
+    const float bandTop = static_cast<float>(firstRow * tileSize);
+    const float bandBottom = static_cast<float>(std::min((firstRow + rows) * tileSize, height));
+    auto tileRange = [&](size_t idx) {
+      // bounding box relative to the image
+      float minX = width, minY = height, maxX = 0.f, maxY = 0.f;
+      for (const Point &pt : path.polygon(idx)) {
+        minX = std::min(minX, pt.x - x0);
+        minY = std::min(minY, pt.y - y0);
+        maxX = std::max(maxX, pt.x - x0);
+        maxY = std::max(maxY, pt.y - y0);
+      }
+      auto toTile = [&](float value, int first, int tiles) {
+        return std::clamp(static_cast<int>(std::floor(value / tileSize)), first, first + tiles - 1) - first;
+      };
+      const bool visible = maxX + extent >= 0.f && maxY + extent >= bandTop && minX - extent < width && minY - extent < bandBottom;
+      return std::make_tuple(visible, toTile(minX - extent, 0, tilesPerRow), toTile(minY - extent, firstRow, rows), toTile(maxX + extent, 0, tilesPerRow), toTile(maxY + extent, firstRow, rows));
+    };
+
+    for (size_t idx = 0; idx < path.size(); ++idx) {
+      const auto [visible, tx0, ty0, tx1, ty1] = tileRange(idx);
+      for (int ty = ty0; visible && ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+          ++bins.start[ty * tilesPerRow + tx + 1];
+        }
+      }
+    }
+    for (size_t tile = 1; tile < bins.start.size(); ++tile) {
+      bins.start[tile] += bins.start[tile - 1];
+    }
+    bins.items.resize(bins.start.back());
+    std::vector<uint32_t> next(bins.start.begin(), bins.start.end() - 1);
+    for (size_t idx = 0; idx < path.size(); ++idx) {
+      const auto [visible, tx0, ty0, tx1, ty1] = tileRange(idx);
+      for (int ty = ty0; visible && ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+          bins.items[next[ty * tilesPerRow + tx]++] = static_cast<uint32_t>(idx);
+        }
+      }
+    }
+    return bins;
+  }
+
+  // image origin in the plane and size in pixels
+  int x0;
+  int y0;
+  int width;
+  int height;
+  RGB background;
+  int threads;
+  std::vector<Path> paths;
+  std::vector<Path> layers;
+  std::FILE *file = nullptr;
+};
+
+} // namespace raster
@@ -0,0 +1,84 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <parallel.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace rng {
+
+// SplitMix64 finalizer
+constexpr uint64_t mix64(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// 32 bits finalizer with a low bias, it only use 32 bits multiplications so loops over it vectorize
+constexpr uint32_t mix32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Counter based generator : the value drawn for a counter only depends on the seed, the stream
+// and the counter. Values can be drawn in any order, from any thread and in bulk, independent
+// streams of the same seed are used for independent decisions (flags, holes, ...).
+class Generator {
+public:
+  constexpr Generator(uint64_t seed, uint64_t stream)
+      : key(mix64(seed ^ mix64(stream + 0x9e3779b97f4a7c15ull))) {
+  }
+
+  constexpr uint32_t operator()(uint32_t counter) const {
+    return mix32(mix32(counter ^ static_cast<uint32_t>(key)) + static_cast<uint32_t>(key >> 32));
+  }
+
+  // Integer in [0, bound)
+  constexpr uint32_t uniform(uint32_t counter, uint32_t bound) const {
+    return static_cast<uint32_t>((static_cast<uint64_t>((*this)(counter)) * bound) >> 32);
+  }
+
+private:
+  uint64_t key;
+};
+
+// Counter of a position, for tiles that are not produced in a fixed order.
+// Coordinates are rounded to 1/16 so the same tile computed twice gives the same counter.
+inline uint32_t positionCounter(float x, float y) {
+  const uint64_t qx = static_cast<uint32_t>(static_cast<int32_t>(std::lround(x * 16.f)));
+  const uint64_t qy = static_cast<uint32_t>(static_cast<int32_t>(std::lround(y * 16.f)));
+  return static_cast<uint32_t>(mix64((qx << 32) | qy));
+}
+
+// out[idx] = uniform(counter(idx), bound) >= threshold for each idx.
+// Iterations are independent so large arrays are split across threads.
+template <typename Counter>
+void drawAtLeast(const Generator &generator, uint32_t bound, uint32_t threshold, std::span<uint8_t> out, Counter &&counter, int threads = 1) {
+  constexpr size_t chunkSize = 1 << 16;
+  const size_t chunks = (out.size() + chunkSize - 1) / chunkSize;
+  parallel::forEach(chunks, threads, [&](size_t chunk) {
+    const size_t end = std::min(out.size(), (chunk + 1) * chunkSize);
+    for (size_t idx = chunk * chunkSize; idx < end; ++idx) {
+      out[idx] = generator.uniform(counter(idx), bound) >= threshold;
+    }
+  });
+}
+
+} // namespace rng
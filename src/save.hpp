@@ -11,27 +11,227 @@
 #pragma once
 
 #include <penrose.hpp>
+#include <stats.hpp>
 
 #include <spdlog/spdlog.h>
 #include <fmt/ostream.h>
 
-#include <fstream>
-#include <random>
-#include <vector>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace svg {
 
 namespace details {
 
-std::string to_path(const Triangle &tr) {
+// Path data are appended to buffer followed by a separator, no temporary string is created
+inline void to_path(fmt::memory_buffer &buffer, const Triangle &tr) {
   // we don't close the path at the end, this allow to draw border on only 2 sides of the triangle
   // we don't want to draw the border between 2nd and 3rd vertices
-  return fmt::format("M {} {} L {} {} L {} {}", tr.vertices[2].x, tr.vertices[2].y, tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y);
+  fmt::format_to(std::back_inserter(buffer), "M {} {} L {} {} L {} {} ", tr.vertices[2].x, tr.vertices[2].y, tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y);
+}
+inline void to_path(fmt::memory_buffer &buffer, const Quadrilateral &tr) {
+  fmt::format_to(std::back_inserter(buffer), "M {} {} L {} {} L {} {} L {} {} Z ", tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y, tr.vertices[3].x, tr.vertices[3].y, tr.vertices[2].x, tr.vertices[2].y);
+}
+inline void to_path(fmt::memory_buffer &buffer, const Polyline &line) {
+  if (line.points.empty()) {
+    return;
+  }
+  fmt::format_to(std::back_inserter(buffer), "M {} {} L", line.points[0].x, line.points[0].y);
+  for (size_t idx = 1; idx < line.points.size(); ++idx) {
+    fmt::format_to(std::back_inserter(buffer), " {} {}", line.points[idx].x, line.points[idx].y);
+  }
+  buffer.push_back(' ');
+}
+
+// Write value / 10^precision with at most precision decimals, without trailing zeros nor leading zero
+inline void format_fixed(fmt::memory_buffer &buffer, int64_t value, int precision) {
+  char digits[24];
+  char *const end = digits + sizeof(digits);
+  char *ptr = end;
+  uint64_t remaining = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+  int decimals = precision;
+  while (decimals > 0 && remaining % 10 == 0) {
+    remaining /= 10;
+    --decimals;
+  }
+  for (int d = 0; d < decimals; ++d) {
+    *--ptr = static_cast<char>('0' + remaining % 10);
+    remaining /= 10;
+  }
+  if (decimals > 0) {
+    *--ptr = '.';
+  }
+  if (remaining != 0 || decimals == 0) {
+    do {
+      *--ptr = static_cast<char>('0' + remaining % 10);
+      remaining /= 10;
+    } while (remaining != 0);
+  }
+  if (value < 0) {
+    *--ptr = '-';
+  }
+  buffer.append(ptr, end);
+}
+
+// Compact path encoding : coordinates are quantized to precision decimals and written relative
+// to the previous point. Each polygon is a "m" command followed by implicit relative line-to,
+// separators are only written when the next number is not negative.
+// Deltas are computed on quantized coordinates so rounding errors don't accumulate along a path.
+class CompactPath {
+public:
+  explicit CompactPath(int precision)
+      : precision(precision), scale(std::pow(10., precision)) {
+  }
+
+  // a "m" at the beginning of a path is absolute, the current point restart at the origin
+  void reset() {
+    current = start = {0, 0};
+  }
+
+  void moveTo(fmt::memory_buffer &buffer, const Point &pt) {
+    buffer.push_back('m');
+    write(buffer, pt, true);
+    start = current;
+  }
+
+  void lineTo(fmt::memory_buffer &buffer, const Point &pt) {
+    write(buffer, pt, false);
+  }
+
+  void close(fmt::memory_buffer &buffer) {
+    buffer.push_back('z');
+    current = start;
+  }
+
+private:
+  void write(fmt::memory_buffer &buffer, const Point &pt, bool afterCommand) {
+    const std::array<int64_t, 2> quantized = {std::llround(pt.x * scale), std::llround(pt.y * scale)};
+    for (size_t axis = 0; axis < 2; ++axis) {
+      const int64_t delta = quantized[axis] - current[axis];
+      if (delta >= 0 && !(afterCommand && axis == 0)) {
+        buffer.push_back(' ');
+      }
+      format_fixed(buffer, delta, precision);
+    }
+    current = quantized;
+  }
+
+  int precision;
+  double scale;
+  std::array<int64_t, 2> current = {0, 0};
+  std::array<int64_t, 2> start = {0, 0};
+};
+
+inline void to_path(fmt::memory_buffer &buffer, const Triangle &tr, CompactPath &path) {
+  // same vertex order and open path than the full precision version
+  path.moveTo(buffer, tr.vertices[2]);
+  path.lineTo(buffer, tr.vertices[0]);
+  path.lineTo(buffer, tr.vertices[1]);
 }
-std::string to_path(const Quadrilateral &tr) {
-  return fmt::format("M {} {} L {} {} L {} {} L {} {} Z", tr.vertices[0].x, tr.vertices[0].y, tr.vertices[1].x, tr.vertices[1].y, tr.vertices[3].x, tr.vertices[3].y, tr.vertices[2].x, tr.vertices[2].y);
+inline void to_path(fmt::memory_buffer &buffer, const Quadrilateral &tr, CompactPath &path) {
+  path.moveTo(buffer, tr.vertices[0]);
+  path.lineTo(buffer, tr.vertices[1]);
+  path.lineTo(buffer, tr.vertices[3]);
+  path.lineTo(buffer, tr.vertices[2]);
+  path.close(buffer);
+}
+inline void to_path(fmt::memory_buffer &buffer, const Polyline &line, CompactPath &path) {
+  if (line.points.empty()) {
+    return;
+  }
+  path.moveTo(buffer, line.points[0]);
+  for (size_t idx = 1; idx < line.points.size(); ++idx) {
+    path.lineTo(buffer, line.points[idx]);
+  }
 }
+
+// Anonymous temporary file holding the part of a path already generated, it is removed once closed
+class TempFile {
+public:
+  TempFile()
+      : file(std::tmpfile()) {
+    if (!file) {
+      throw std::runtime_error("Cannot create a temporary file");
+    }
+  }
+
+  TempFile(TempFile &&other) noexcept
+      : file(std::exchange(other.file, nullptr)), bytes(other.bytes) {
+  }
+
+  TempFile &operator=(TempFile &&other) noexcept {
+    std::swap(file, other.file);
+    std::swap(bytes, other.bytes);
+    return *this;
+  }
+
+  ~TempFile() {
+    if (file) {
+      std::fclose(file);
+    }
+  }
+
+  void write(const void *data, size_t size) {
+    if (std::fwrite(data, 1, size, file) != size) {
+      throw std::runtime_error("Cannot write a temporary file");
+    }
+    bytes += size;
+  }
+
+  // Start reading from the beginning, the writes are over
+  void rewind() {
+    if (std::fflush(file) != 0 || std::fseek(file, 0, SEEK_SET) != 0) {
+      throw std::runtime_error("Cannot read a temporary file");
+    }
+  }
+
+  void read(void *data, size_t size) {
+    if (std::fread(data, 1, size, file) != size) {
+      throw std::runtime_error("Cannot read a temporary file");
+    }
+  }
+
+  // Call consumer(data, size) on the whole content in chunks of at most chunkSize bytes
+  template <typename Consumer>
+  void readAll(size_t chunkSize, Consumer &&consumer) {
+    rewind();
+    std::vector<char> chunk(std::min(chunkSize, bytes));
+    for (size_t remaining = bytes; remaining > 0;) {
+      const size_t size = std::min(chunk.size(), remaining);
+      read(chunk.data(), size);
+      consumer(chunk.data(), size);
+      remaining -= size;
+    }
+  }
+
+  size_t size() const {
+    return bytes;
+  }
+
+private:
+  std::FILE *file;
+  size_t bytes = 0;
+};
+
+struct AcceptAll {
+  template <typename T>
+  bool operator()(const T &, size_t) const {
+    return true;
+  }
+};
 } // namespace details
 
 struct RGB {
@@ -85,55 +285,252 @@ struct StrokesStyle {
   }
 };
 
+using Style = std::pair<std::optional<Fill>, std::optional<StrokesStyle>>;
+
+// Paths given to addPolygon are formatted in a single buffer. Once the document is opened on a file or a
+// sink, that buffer is written each time it exceeds chunkSize. Layers are filled until the document is
+// finished, and each of their chunks moves to a temporary file, so memory does not grow with the document
+// in either case. A document that is not opened is built in memory for getContent.
 class Document {
 public:
-  Document(size_t canvasSize, RGB background) {
-    data = fmt::format("<svg xmlns='http://www.w3.org/2000/svg' height='{size}' width='{size}' viewBox='0 0 {size} {size}'>\n"
-                      "<rect height='100%' width='100%' fill='{background}'/>\n"
-                      "<g id='surface1'>\n",
-                      fmt::arg("size", canvasSize),
-                      fmt::arg("background", background)
-      );
+  static constexpr size_t chunkSize = 1 << 20;
+
+  // Receives the document chunk after chunk, returns false when the bytes cannot be written
+  using Sink = std::function<bool(const char *bytes, size_t size)>;
+
+  // With a precision, coordinates are written with the compact encoding rounded to precision decimals
+  Document(size_t canvasSize, RGB background, std::optional<int> precision = {})
+      : Document(Rectangle(Point(0, 0), Point(canvasSize, canvasSize)), background, precision) {
   }
 
-  template <typename T>
-  void addPolygon(std::vector<T> polygons, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle, std::function<bool(const std::type_identity_t<T>&, size_t)> func = [](const T &, size_t){ return true; }) {
-    data += fmt::format("<path style='{};{}' d='", color, strokeStyle);
-    for (size_t idx = 0; idx < polygons.size(); ++idx) {
-      const T& polygon = polygons[idx];
-      if (func(polygon, idx))
-        data += details::to_path(polygons[idx]) + " ";
+  // Document showing only the view part of the plane, polygons keep their plane coordinates
+  Document(const Rectangle &view, RGB background, std::optional<int> precision = {})
+      : precision(precision) {
+    data.append(fmt::format("<svg xmlns='http://www.w3.org/2000/svg' height='{height}' width='{width}' viewBox='{x} {y} {width} {height}'>\n"
+                            "<rect x='{x}' y='{y}' height='100%' width='100%' fill='{background}'/>\n"
+                            "<g id='surface1'>\n",
+                            fmt::arg("x", view.min.x),
+                            fmt::arg("y", view.min.y),
+                            fmt::arg("width", view.max.x - view.min.x),
+                            fmt::arg("height", view.max.y - view.min.y),
+                            fmt::arg("background", background)));
+  }
+
+  Document(const Document &) = delete;
+  Document &operator=(const Document &) = delete;
+
+  ~Document() {
+    if (file) {
+      std::fclose(file);
     }
-    data += "'></path>\n";
+  }
+
+  // Stream the document to filename while it is built
+  bool open(const std::string &filename) {
+    file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+      spdlog::error("Cannot open output file : {}.", filename);
+      return false;
+    }
+    flush();
+    return true;
+  }
+
+  // Stream the document to output while it is built, no file and no intermediate string are involved
+  void open(Sink output) {
+    sink = std::move(output);
+    flush();
+  }
+
+  // Add the polygons accepted by filter(polygon, idx) in a single path, polygons can be any random access range
+  template <std::ranges::random_access_range Range, typename Filter = details::AcceptAll>
+  void addPolygon(const Range &polygons, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle, Filter &&filter = {}) {
+    const stats::Timer timer("svg");
+    beginPath(color, strokeStyle);
+    for (size_t idx = 0; idx < std::ranges::size(polygons); ++idx) {
+      const auto &polygon = polygons[idx];
+      bool accepted;
+      if constexpr (std::is_invocable_v<Filter, decltype(polygon), size_t>) {
+        accepted = filter(polygon, idx);
+      } else {
+        accepted = filter(polygon);
+      }
+      if (accepted) {
+        appendPath(data, polygon, cursor);
+        flushIfFull();
+      }
+    }
+    endPath();
   }
 
   template <typename T>
-  void addPolygon(std::vector<T> polygons, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle, std::function<bool(const std::type_identity_t<T>&)> func) {
-    addPolygon(polygons, color, strokeStyle, [func](T value, size_t){ return func(value); });
+  requires(!std::ranges::range<T>)
+  void addPolygon(const T &polygon, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle) {
+    addPolygon(std::span<const T>(&polygon, 1), color, strokeStyle);
+  }
+
+  // Add polygons to several styles in one pass over them.
+  // classify(polygon, idx) return a bit mask of the styles the polygon belongs to, bit i for styles[i].
+  // Only polygon indices are stored per style, the path data are formatted style after style.
+  template <std::ranges::random_access_range Range, typename Classify>
+  void addPolygons(const Range &polygons, const std::vector<Style> &styles, Classify &&classify) {
+    const stats::Timer timer("svg");
+    std::vector<std::vector<uint32_t>> buckets(styles.size());
+    for (size_t idx = 0; idx < std::ranges::size(polygons); ++idx) {
+      const uint32_t mask = classify(polygons[idx], idx);
+      for (size_t style = 0; style < styles.size(); ++style) {
+        if (mask & (1u << style)) {
+          buckets[style].push_back(static_cast<uint32_t>(idx));
+        }
+      }
+    }
+    for (size_t style = 0; style < styles.size(); ++style) {
+      beginPath(styles[style].first, styles[style].second);
+      for (uint32_t idx : buckets[style]) {
+        appendPath(data, polygons[idx], cursor);
+        flushIfFull();
+      }
+      endPath();
+      buckets[style] = {};
+    }
+  }
+
+  // Layers are filled one polygon at a time and are written after the polygons given to addPolygon.
+  // Each chunk of a layer is moved to a temporary file, so layers don't keep the whole document in memory.
+  size_t addLayer(std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle) {
+    layers.emplace_back();
+    layers.back().append(fmt::format("<path style='{};{}' d='", color, strokeStyle));
+    layerCursors.emplace_back(precision.value_or(0));
+    layerFiles.emplace_back();
+    return layers.size() - 1;
   }
 
   template <typename T>
-  void addPolygon(T polygon, std::optional<Fill> color, std::optional<StrokesStyle> strokeStyle) {
-    addPolygon(std::vector<T>{polygon}, color, strokeStyle);
+  void addToLayer(size_t layer, const T &polygon) {
+    appendPath(layers[layer], polygon, layerCursors[layer]);
+    if (layers[layer].size() >= chunkSize) {
+      if (!layerFiles[layer]) {
+        layerFiles[layer].emplace();
+      }
+      layerFiles[layer]->write(layers[layer].data(), layers[layer].size());
+      layers[layer].clear();
+    }
   }
 
+  // Full content of a document that was not opened on a file or a sink
   std::string getContent() {
-    return data + "</g>\n</svg>\n";
+    if (file || sink) {
+      throw std::runtime_error("Document content was already written to a file");
+    }
+    std::string content = fmt::to_string(data);
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+      if (layerFiles[layer]) {
+        layerFiles[layer]->readAll(chunkSize, [&](const char *bytes, size_t size) {
+          content.append(bytes, size);
+        });
+      }
+      content.append(layers[layer].data(), layers[layer].size());
+      content += "'></path>\n";
+    }
+    return content + "</g>\n</svg>\n";
   }
 
+  // Finish the document, it is written to filename unless it was already opened on a file
   bool save(const std::string &filename) {
-    std::ofstream out(filename);
-    if (!out) {
-      spdlog::error("Cannot open output file : {}.", filename);
+    if (!file && !open(filename)) {
       return false;
     }
+    finish();
+    const bool ok = std::fclose(file) == 0;
+    file = nullptr;
+    if (!ok) {
+      spdlog::error("Cannot write output file : {}.", filename);
+    }
+    return ok;
+  }
 
-    out << getContent();
-    return true;
+  // Write the end of a document opened on a file or a sink
+  void finish() {
+    const stats::Timer timer("svg");
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+      const size_t spilled = layerFiles[layer] ? layerFiles[layer]->size() : 0;
+      if (stats::enabled()) {
+        stats::add(fmt::format("svg.path{}.bytes", paths++), spilled + layers[layer].size() + std::string_view("'></path>\n").size());
+      }
+      flush();
+      if (layerFiles[layer]) {
+        layerFiles[layer]->readAll(chunkSize, [&](const char *bytes, size_t size) {
+          write(bytes, size);
+        });
+        layerFiles[layer].reset();
+      }
+      write(layers[layer].data(), layers[layer].size());
+      layers[layer] = fmt::memory_buffer();
+      data.append(std::string_view("'></path>\n"));
+    }
+    data.append(std::string_view("</g>\n</svg>\n"));
+    flush();
   }
 
 private:
-  std::string data;
+  void beginPath(const std::optional<Fill> &color, const std::optional<StrokesStyle> &strokeStyle) {
+    pathStart = written + data.size();
+    data.append(fmt::format("<path style='{};{}' d='", color, strokeStyle));
+    cursor.reset();
+  }
+
+  template <typename T>
+  void appendPath(fmt::memory_buffer &buffer, const T &polygon, details::CompactPath &path) {
+    if (precision) {
+      details::to_path(buffer, polygon, path);
+    } else {
+      details::to_path(buffer, polygon);
+    }
+  }
+
+  void endPath() {
+    data.append(std::string_view("'></path>\n"));
+    if (stats::enabled()) {
+      stats::add(fmt::format("svg.path{}.bytes", paths++), written + data.size() - pathStart);
+    }
+    flushIfFull();
+  }
+
+  void flushIfFull() {
+    if (data.size() >= chunkSize) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (file || sink) {
+      write(data.data(), data.size());
+      data.clear();
+    }
+  }
+
+  void write(const char *bytes, size_t size) {
+    if (size == 0) {
+      return;
+    }
+    if (file ? std::fwrite(bytes, 1, size, file) != size : !sink(bytes, size)) {
+      throw std::runtime_error("Cannot write output file");
+    }
+    written += size;
+  }
+
+  std::optional<int> precision;
+  details::CompactPath cursor{precision.value_or(0)};
+  fmt::memory_buffer data;
+  std::vector<fmt::memory_buffer> layers;
+  std::vector<details::CompactPath> layerCursors;
+  std::vector<std::optional<details::TempFile>> layerFiles;
+  std::FILE *file = nullptr;
+  Sink sink;
+  // bytes already written to file and position of the current path start, for the stats of each path
+  size_t written = 0;
+  size_t pathStart = 0;
+  size_t paths = 0;
 };
 
 } // namespace svg
\ No newline at end of file
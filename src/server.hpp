@@ -0,0 +1,341 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace server {
+
+// Request protocol
+// A request is a json object on a single line. Its fields are command line options, numbers and strings are
+// option values, true enables a flag and false or null leave the option unset. The response is a json
+// header line followed by the number of bytes given in its "bytes" field:
+//   {"id": "1", "status": "ok", "format": "png", "seed": 42, "bytes": 123456}\n<123456 bytes>
+//   {"id": "1", "status": "error", "message": "...", "bytes": 0}\n
+// Requests are served concurrently, the "id" field of the request is sent back to match the responses.
+
+struct Field {
+  std::string name;
+  // text of strings without their quotes, raw text of the other values
+  std::string value;
+  bool isString;
+};
+
+// Fields of a flat json object, nested objects and arrays are not accepted
+inline std::vector<Field> parseObject(std::string_view text) {
+  size_t pos = 0;
+  auto fail = [&](const char *expected) {
+    throw std::runtime_error(fmt::format("Invalid request at character {} : expected {}", pos, expected));
+  };
+  auto skipSpaces = [&] {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+      ++pos;
+    }
+  };
+  auto parseString = [&] {
+    if (pos >= text.size() || text[pos] != '"') {
+      fail("a string");
+    }
+    std::string out;
+    for (++pos; pos < text.size() && text[pos] != '"'; ++pos) {
+      if (text[pos] != '\\') {
+        out += text[pos];
+        continue;
+      }
+      if (++pos >= text.size()) {
+        break;
+      }
+      switch (text[pos]) {
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+        // code points of the basic plane, written in utf-8
+        uint32_t code = 0;
+        for (int digit = 0; digit < 4; ++digit) {
+          const char c = ++pos < text.size() ? text[pos] : '\0';
+          if (!std::isxdigit(static_cast<unsigned char>(c))) {
+            fail("4 hexadecimal digits");
+          }
+          code = code * 16 + static_cast<uint32_t>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : std::tolower(c) - 'a' + 10);
+        }
+        if (code < 0x80) {
+          out += static_cast<char>(code);
+        } else if (code < 0x800) {
+          out += static_cast<char>(0xC0 | (code >> 6));
+          out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+          out += static_cast<char>(0xE0 | (code >> 12));
+          out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+          out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        break;
+      }
+      default: out += text[pos]; break;
+      }
+    }
+    if (pos >= text.size()) {
+      fail("the end of the string");
+    }
+    ++pos;
+    return out;
+  };
+
+  std::vector<Field> fields;
+  skipSpaces();
+  if (pos >= text.size() || text[pos] != '{') {
+    fail("{");
+  }
+  ++pos;
+  skipSpaces();
+  if (pos < text.size() && text[pos] == '}') {
+    ++pos;
+  } else {
+    for (;;) {
+      skipSpaces();
+      Field field;
+      field.name = parseString();
+      skipSpaces();
+      if (pos >= text.size() || text[pos] != ':') {
+        fail(":");
+      }
+      ++pos;
+      skipSpaces();
+      field.isString = pos < text.size() && text[pos] == '"';
+      if (field.isString) {
+        field.value = parseString();
+      } else {
+        const size_t start = pos;
+        while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '-' || text[pos] == '+' || text[pos] == '.')) {
+          ++pos;
+        }
+        field.value = std::string(text.substr(start, pos - start));
+        if (field.value.empty()) {
+          fail("a string, a number, true, false or null");
+        }
+      }
+      fields.push_back(std::move(field));
+      skipSpaces();
+      if (pos < text.size() && text[pos] == ',') {
+        ++pos;
+        continue;
+      }
+      if (pos < text.size() && text[pos] == '}') {
+        ++pos;
+        break;
+      }
+      fail(", or }");
+    }
+  }
+  skipSpaces();
+  if (pos != text.size()) {
+    fail("the end of the line");
+  }
+  return fields;
+}
+
+// Json string of text, with its quotes
+inline std::string quote(std::string_view text) {
+  std::string out = "\"";
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out += fmt::format("\\u{:04x}", static_cast<int>(c));
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// Blocking byte stream on a socket or on the standard input and output
+class Connection {
+public:
+  static constexpr size_t bufferSize = 1 << 16;
+  // longest request line, a longer line closes the connection instead of growing the buffer without bound
+  static constexpr size_t maxLineLength = 1 << 20;
+
+  // A socket is read and written through the same descriptor, it is closed with the connection
+  explicit Connection(int socket)
+      : input(socket), output(socket), owned(true) {
+  }
+
+  // Standard input and output, they are switched to binary mode
+  Connection()
+      : input(0), output(1), owned(false) {
+#if defined(_WIN32)
+    _setmode(input, _O_BINARY);
+    _setmode(output, _O_BINARY);
+#endif
+  }
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  ~Connection() {
+#if !defined(_WIN32)
+    if (owned) {
+      ::close(input);
+    }
+#endif
+  }
+
+  // Next line without its end of line, false once the stream is closed or when the line is longer than maxLineLength
+  bool readLine(std::string &line) {
+    for (;;) {
+      const size_t end = buffer.find('\n', scanned);
+      if (std::min(end, buffer.size()) > maxLineLength) {
+        lineTooLong = true;
+        buffer.clear();
+        return false;
+      }
+      if (end != std::string::npos) {
+        line.assign(buffer, 0, end);
+        buffer.erase(0, end + 1);
+        scanned = 0;
+        return true;
+      }
+      scanned = buffer.size();
+      char chunk[bufferSize];
+      const auto count = readSome(chunk, sizeof(chunk));
+      if (count <= 0) {
+        // last line without end of line
+        line = std::move(buffer);
+        buffer.clear();
+        scanned = 0;
+        return !line.empty();
+      }
+      buffer.append(chunk, static_cast<size_t>(count));
+    }
+  }
+
+  // The last readLine stopped on a line longer than maxLineLength
+  bool isLineTooLong() const {
+    return lineTooLong;
+  }
+
+  // Write a response, the responses of concurrent requests are never interleaved
+  bool send(std::string_view header, std::string_view payload) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writeAll(header) && writeAll(payload);
+  }
+
+private:
+  long readSome(char *bytes, size_t size) {
+#if defined(_WIN32)
+    return _read(input, bytes, static_cast<unsigned int>(size));
+#else
+    ssize_t count;
+    do {
+      count = ::read(input, bytes, size);
+    } while (count < 0 && errno == EINTR);
+    return static_cast<long>(count);
+#endif
+  }
+
+  bool writeAll(std::string_view bytes) {
+    while (!bytes.empty()) {
+#if defined(_WIN32)
+      const long count = _write(output, bytes.data(), static_cast<unsigned int>(bytes.size()));
+#else
+      const ssize_t count = ::write(output, bytes.data(), bytes.size());
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+#endif
+      if (count <= 0) {
+        return false;
+      }
+      bytes.remove_prefix(static_cast<size_t>(count));
+    }
+    return true;
+  }
+
+  int input;
+  int output;
+  bool owned;
+  std::string buffer;
+  // bytes of buffer already searched for an end of line
+  size_t scanned = 0;
+  bool lineTooLong = false;
+  std::mutex mutex;
+};
+
+#if !defined(_WIN32)
+// Listening unix domain socket at path, a previous socket at path is replaced but any other file is kept
+inline int listenUnix(const std::string &path) {
+  sockaddr_un address = {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error(fmt::format("Socket path is too long : {}", path));
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  struct stat info;
+  if (::lstat(path.c_str(), &info) == 0) {
+    if (!S_ISSOCK(info.st_mode)) {
+      throw std::runtime_error(fmt::format("Cannot listen on {} : the file exists and is not a socket", path));
+    }
+    ::unlink(path.c_str());
+  }
+
+  // a client closing its connection early must not stop the server
+  std::signal(SIGPIPE, SIG_IGN);
+  const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    throw std::runtime_error(fmt::format("Cannot create socket : {}", std::strerror(errno)));
+  }
+  if (::bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0) {
+    const int error = errno;
+    ::close(listener);
+    throw std::runtime_error(fmt::format("Cannot listen on socket {} : {}", path, std::strerror(error)));
+  }
+  return listener;
+}
+
+// Next client of listener, negative on failure
+inline int acceptClient(int listener) {
+  int client;
+  do {
+    client = ::accept(listener, nullptr, nullptr);
+  } while (client < 0 && errno == EINTR);
+  return client;
+}
+#endif
+
+} // namespace server
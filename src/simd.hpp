@@ -0,0 +1,162 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PENROSE_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace simd {
+
+// Single lane fallback, also used to process the tail of arrays
+struct Scalar {
+  static constexpr size_t width = 1;
+  float v;
+
+  static Scalar load(const float *ptr) {
+    return {*ptr};
+  }
+  static Scalar broadcast(float value) {
+    return {value};
+  }
+  void store(float *ptr) const {
+    *ptr = v;
+  }
+};
+
+inline Scalar operator+(Scalar lhs, Scalar rhs) {
+  return {lhs.v + rhs.v};
+}
+inline Scalar operator-(Scalar lhs, Scalar rhs) {
+  return {lhs.v - rhs.v};
+}
+inline Scalar operator*(Scalar lhs, Scalar rhs) {
+  return {lhs.v * rhs.v};
+}
+inline Scalar operator/(Scalar lhs, Scalar rhs) {
+  return {lhs.v / rhs.v};
+}
+inline Scalar sqrt(Scalar value) {
+  return {std::sqrt(value.v)};
+}
+inline Scalar abs(Scalar value) {
+  return {std::abs(value.v)};
+}
+// 1 if value is strictly positive, -1 otherwise
+inline Scalar sign(Scalar value) {
+  return {value.v > 0.f ? 1.f : -1.f};
+}
+
+#if defined(__AVX2__)
+
+struct Float {
+  static constexpr size_t width = 8;
+  __m256 v;
+
+  static Float load(const float *ptr) {
+    return {_mm256_loadu_ps(ptr)};
+  }
+  static Float broadcast(float value) {
+    return {_mm256_set1_ps(value)};
+  }
+  void store(float *ptr) const {
+    _mm256_storeu_ps(ptr, v);
+  }
+};
+
+inline Float operator+(Float lhs, Float rhs) {
+  return {_mm256_add_ps(lhs.v, rhs.v)};
+}
+inline Float operator-(Float lhs, Float rhs) {
+  return {_mm256_sub_ps(lhs.v, rhs.v)};
+}
+inline Float operator*(Float lhs, Float rhs) {
+  return {_mm256_mul_ps(lhs.v, rhs.v)};
+}
+inline Float operator/(Float lhs, Float rhs) {
+  return {_mm256_div_ps(lhs.v, rhs.v)};
+}
+inline Float sqrt(Float value) {
+  return {_mm256_sqrt_ps(value.v)};
+}
+inline Float abs(Float value) {
+  return {_mm256_andnot_ps(_mm256_set1_ps(-0.f), value.v)};
+}
+inline Float sign(Float value) {
+  const __m256 positive = _mm256_cmp_ps(value.v, _mm256_setzero_ps(), _CMP_GT_OQ);
+  return {_mm256_blendv_ps(_mm256_set1_ps(-1.f), _mm256_set1_ps(1.f), positive)};
+}
+
+#elif defined(PENROSE_SIMD_SSE2)
+
+struct Float {
+  static constexpr size_t width = 4;
+  __m128 v;
+
+  static Float load(const float *ptr) {
+    return {_mm_loadu_ps(ptr)};
+  }
+  static Float broadcast(float value) {
+    return {_mm_set1_ps(value)};
+  }
+  void store(float *ptr) const {
+    _mm_storeu_ps(ptr, v);
+  }
+};
+
+inline Float operator+(Float lhs, Float rhs) {
+  return {_mm_add_ps(lhs.v, rhs.v)};
+}
+inline Float operator-(Float lhs, Float rhs) {
+  return {_mm_sub_ps(lhs.v, rhs.v)};
+}
+inline Float operator*(Float lhs, Float rhs) {
+  return {_mm_mul_ps(lhs.v, rhs.v)};
+}
+inline Float operator/(Float lhs, Float rhs) {
+  return {_mm_div_ps(lhs.v, rhs.v)};
+}
+inline Float sqrt(Float value) {
+  return {_mm_sqrt_ps(value.v)};
+}
+inline Float abs(Float value) {
+  return {_mm_andnot_ps(_mm_set1_ps(-0.f), value.v)};
+}
+inline Float sign(Float value) {
+  const __m128 positive = _mm_cmpgt_ps(value.v, _mm_setzero_ps());
+  return {_mm_or_ps(_mm_and_ps(positive, _mm_set1_ps(1.f)), _mm_andnot_ps(positive, _mm_set1_ps(-1.f)))};
+}
+
+#else
+
+using Float = Scalar;
+
+#endif
+
+// Call kernel(Float{}, idx) on packs of Float::width elements then kernel(Scalar{}, idx) on the remaining ones
+template <typename Kernel>
+void forEach(size_t size, Kernel &&kernel) {
+  size_t idx = 0;
+  for (; idx + Float::width <= size; idx += Float::width) {
+    kernel(Float{}, idx);
+  }
+  for (; idx < size; ++idx) {
+    kernel(Scalar{}, idx);
+  }
+}
+
+} // namespace simd
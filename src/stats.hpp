@@ -0,0 +1,268 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(PENROSE_STATS)
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#endif
+
+// Replace the global operator new and delete of the program, onAllocation(size) is called on each allocation.
+// Used once at global scope in the file holding main. gcc pairs the inlined malloc of operator new with the
+// free of operator delete and warns, the warning is only disabled for the replacement functions.
+#if defined(__GNUC__) && !defined(__clang__)
+#define STATS_DIAGNOSTIC_PUSH _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")
+#define STATS_DIAGNOSTIC_POP _Pragma("GCC diagnostic pop")
+#else
+#define STATS_DIAGNOSTIC_PUSH
+#define STATS_DIAGNOSTIC_POP
+#endif
+
+#define STATS_REPLACE_OPERATOR_NEW(onAllocation)   \
+  STATS_DIAGNOSTIC_PUSH                            \
+  void *operator new(std::size_t size) {           \
+    onAllocation(size);                            \
+    if (void *ptr = std::malloc(size ? size : 1)) { \
+      return ptr;                                  \
+    }                                              \
+    throw std::bad_alloc();                        \
+  }                                                \
+  void *operator new[](std::size_t size) {         \
+    return operator new(size);                     \
+  }                                                \
+  void operator delete(void *ptr) noexcept {       \
+    std::free(ptr);                                \
+  }                                                \
+  void operator delete[](void *ptr) noexcept {     \
+    std::free(ptr);                                \
+  }                                                \
+  void operator delete(void *ptr, std::size_t) noexcept { \
+    std::free(ptr);                                \
+  }                                                \
+  void operator delete[](void *ptr, std::size_t) noexcept { \
+    std::free(ptr);                                \
+  }                                                \
+  STATS_DIAGNOSTIC_POP
+
+// Timers and counters of the generation phases.
+// They are compiled in with PENROSE_STATS and only record once enabled at runtime. Without PENROSE_STATS
+// every function is empty and enabled() is a constant false, so the guarded code is removed by the compiler.
+namespace stats {
+
+#if defined(PENROSE_STATS)
+constexpr bool compiled = true;
+#else
+constexpr bool compiled = false;
+#endif
+
+// Tile counts are recorded per level and per TriangleKind, in the order of the enum
+constexpr size_t maxLevels = 32;
+constexpr size_t kindCount = 4;
+
+namespace details {
+
+struct Phase {
+  uint64_t calls = 0;
+  uint64_t nanoseconds = 0;
+};
+
+struct Registry {
+  std::atomic<bool> active = false;
+  std::mutex mutex;
+  std::map<std::string, Phase, std::less<>> phases;
+  std::map<std::string, uint64_t, std::less<>> counters;
+  std::array<std::array<std::atomic<uint64_t>, kindCount>, maxLevels> tiles = {};
+  std::atomic<uint64_t> allocations = 0;
+  std::atomic<uint64_t> allocatedBytes = 0;
+};
+
+inline Registry registry;
+
+} // namespace details
+
+inline bool enabled() {
+  if constexpr (compiled) {
+    return details::registry.active.load(std::memory_order_relaxed);
+  } else {
+    return false;
+  }
+}
+
+inline void enable(bool active = true) {
+  if constexpr (compiled) {
+    details::registry.active = active;
+  }
+}
+
+// Add value to a named counter
+inline void add(std::string_view counter, uint64_t value) {
+  if (!enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(details::registry.mutex);
+  auto it = details::registry.counters.find(counter);
+  if (it == details::registry.counters.end()) {
+    it = details::registry.counters.emplace(std::string(counter), 0).first;
+  }
+  it->second += value;
+}
+
+// Add the number of triangles of each kind produced at level
+inline void addTiles(int level, std::span<const size_t> count) {
+  if (!enabled() || level < 0 || static_cast<size_t>(level) >= maxLevels) {
+    return;
+  }
+  for (size_t kind = 0; kind < std::min(count.size(), kindCount); ++kind) {
+    details::registry.tiles[level][kind].fetch_add(count[kind], std::memory_order_relaxed);
+  }
+}
+
+// Called by the replaced global operator new of the executable
+inline void addAllocation(size_t size) {
+  if (!enabled()) {
+    return;
+  }
+  details::registry.allocations.fetch_add(1, std::memory_order_relaxed);
+  details::registry.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+// Wall time of the enclosing scope, added to phase when the timer is destroyed.
+// Phases running concurrently in several threads add their times.
+class Timer {
+public:
+  explicit Timer(const char *phase)
+      : phase(enabled() ? phase : nullptr) {
+    if (this->phase) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+  ~Timer() {
+    if (!phase) {
+      return;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    std::lock_guard<std::mutex> lock(details::registry.mutex);
+    auto it = details::registry.phases.find(std::string_view(phase));
+    if (it == details::registry.phases.end()) {
+      it = details::registry.phases.emplace(phase, details::Phase{}).first;
+    }
+    ++it->second.calls;
+    it->second.nanoseconds += static_cast<uint64_t>(elapsed.count());
+  }
+
+private:
+  const char *phase;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Peak resident memory of the process in bytes, 0 when unknown
+inline uint64_t peakMemory() {
+#if defined(PENROSE_STATS) && defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#elif defined(PENROSE_STATS)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// All recorded values as a json object
+inline std::string toJson() {
+  auto &registry = details::registry;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  fmt::memory_buffer out;
+  fmt::format_to(std::back_inserter(out), "{{\n  \"phases\": {{");
+  const char *separator = "";
+  for (const auto &[name, phase] : registry.phases) {
+    fmt::format_to(std::back_inserter(out), "{}\n    \"{}\": {{\"calls\": {}, \"milliseconds\": {:.3f}}}", separator, name, phase.calls, phase.nanoseconds / 1e6);
+    separator = ",";
+  }
+  fmt::format_to(std::back_inserter(out), "\n  }},\n  \"counters\": {{");
+  separator = "";
+  for (const auto &[name, value] : registry.counters) {
+    fmt::format_to(std::back_inserter(out), "{}\n    \"{}\": {}", separator, name, value);
+    separator = ",";
+  }
+  fmt::format_to(std::back_inserter(out), "\n  }},\n  \"tiles\": [");
+  separator = "";
+  for (size_t level = 0; level < maxLevels; ++level) {
+    const auto &count = registry.tiles[level];
+    if (count[0] + count[1] + count[2] + count[3] == 0) {
+      continue;
+    }
+    fmt::format_to(std::back_inserter(out), "{}\n    {{\"level\": {}, \"kite\": {}, \"dart\": {}, \"rhombsCyan\": {}, \"rhombsViolet\": {}}}",
+                   separator, level, count[0].load(), count[1].load(), count[2].load(), count[3].load());
+    separator = ",";
+  }
+  fmt::format_to(std::back_inserter(out), "\n  ],\n  \"allocations\": {},\n  \"allocatedBytes\": {},\n  \"peakMemory\": {}\n}}\n",
+                 registry.allocations.load(), registry.allocatedBytes.load(), peakMemory());
+  return fmt::to_string(out);
+}
+
+// All recorded values in the log
+inline void log() {
+  auto &registry = details::registry;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto &[name, phase] : registry.phases) {
+    spdlog::info("stats: {} : {:.3f} ms in {} calls", name, phase.nanoseconds / 1e6, phase.calls);
+  }
+  for (const auto &[name, value] : registry.counters) {
+    spdlog::info("stats: {} : {}", name, value);
+  }
+  for (size_t level = 0; level < maxLevels; ++level) {
+    const auto &count = registry.tiles[level];
+    if (count[0] + count[1] + count[2] + count[3] != 0) {
+      spdlog::info("stats: level {} : {} kites, {} darts, {} cyan rhombs, {} violet rhombs", level, count[0].load(), count[1].load(), count[2].load(), count[3].load());
+    }
+  }
+  spdlog::info("stats: {} allocations, {} bytes allocated, {} bytes peak memory", registry.allocations.load(), registry.allocatedBytes.load(), peakMemory());
+}
+
+} // namespace stats
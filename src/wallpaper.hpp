@@ -0,0 +1,125 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+#pragma once
+
+#include <geometry.hpp>
+#include <penrose.hpp>
+#include <rng.hpp>
+#include <save.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Canvas, initial patch and single level styling shared by the executable and the library
+namespace penrose {
+
+// Output size in pixels, the initial patch is centered on the canvas and covers it
+struct Canvas {
+  int width;
+  int height;
+
+  auto operator<=>(const Canvas &) const = default;
+};
+
+inline float patchRadius(const Canvas &canvas) {
+  return std::max(canvas.width, canvas.height) * 0.8f;
+}
+
+inline Point patchCenter(const Canvas &canvas) {
+  return Point(canvas.width / 2.f, canvas.height / 2.f);
+}
+
+inline Rectangle viewport(const Canvas &canvas) {
+  return {Point(0, 0), Point(canvas.width, canvas.height)};
+}
+
+// Sun of 10 half tiles around the canvas center, darts for kites and darts (P2) or thin rhombs (P3)
+inline std::vector<PenroseTriangle> initialPatch(bool rhombus, const Canvas &canvas) {
+  std::vector<PenroseTriangle> tiling;
+  const float radius = patchRadius(canvas);
+  const Point center = patchCenter(canvas);
+  for (int i = 0, sign = -1; i < 10; ++i, sign *= -1) {
+    const float phi1 = (2 * i - sign) * pi / 10;
+    const float phi2 = (2 * i + sign) * pi / 10;
+
+    if (rhombus) {
+      tiling.emplace_back(
+          TriangleKind::kRhombsCyan,
+          Point(0, 0) + center,
+          radius * Point(cos(phi1), sin(phi1)) + center,
+          radius * Point(cos(phi2), sin(phi2)) + center);
+    } else {
+      tiling.emplace_back(
+          TriangleKind::kDart,
+          radius * Point(cos(phi1), sin(phi1)) + center,
+          Point(0, 0) + center,
+          radius * Point(cos(phi2), sin(phi2)) + center);
+    }
+  }
+  return tiling;
+}
+
+constexpr svg::RGB background{6, 12, 34};
+
+// Independent random decisions drawn from the same seed
+constexpr uint64_t flagStream = 1;
+constexpr uint64_t holeStream = 2;
+
+// Draw of the holes keyed by position, so it does not depend on the generation order. Single level tiles
+// above the threshold are filled, 2 steps tiles above it are holes. A negative threshold is 0, like drawTiling.
+inline bool isAboveThreshold(const rng::Generator &holes, const Point &key, int threshold) {
+  return holes.uniform(rng::positionCounter(key.x, key.y), 11) >= static_cast<uint32_t>(std::max(threshold, 0));
+}
+
+// Layers of the single level styling, their sizes come from the first tile
+struct SingleLevelLayers {
+  size_t light;
+  size_t dark;
+  size_t edges;
+  bool neon;
+  float margin;
+
+  // holes are not filled, their edges are still drawn
+  template <typename Document>
+  void add(Document &doc, PenroseQuadrilateral quad, bool drawn) const {
+    if (neon) {
+      quad = addMargin(quad, margin);
+    }
+    if (drawn) {
+      doc.addToLayer(isSmall(quad.color) ? dark : light, quad);
+    }
+    doc.addToLayer(edges, quad);
+  }
+};
+
+template <typename Document>
+SingleLevelLayers addSingleLevelLayers(Document &doc, PenroseQuadrilateral first, bool neon) {
+  const svg::RGB light = {140, 140, 140};
+  const svg::RGB dark = {70, 70, 70};
+  const float strokesWidth = norm(first.vertices[0] - first.vertices[1]) / 30.0f;
+  const float margin = std::max(3.f, norm(first.vertices[0] - first.vertices[1]) / 15.0f);
+  if (neon) {
+    first = addMargin(first, margin);
+    const float strokesWidthMargin = norm(first.vertices[0] - first.vertices[1]) / 45.0f;
+    const size_t layer1 = doc.addLayer({}, svg::StrokesStyle(light, strokesWidthMargin));
+    const size_t layer2 = doc.addLayer({}, svg::StrokesStyle(dark, strokesWidthMargin));
+    const size_t layer3 = doc.addLayer({}, {});
+    return {layer1, layer2, layer3, neon, margin};
+  }
+  const size_t layer1 = doc.addLayer(svg::Fill{light}, {});
+  const size_t layer2 = doc.addLayer(svg::Fill{dark}, {});
+  const size_t layer3 = doc.addLayer({}, svg::StrokesStyle(0, 0, 0, strokesWidth));
+  return {layer1, layer2, layer3, neon, margin};
+}
+
+} // namespace penrose
@@ -0,0 +1,336 @@
+//
+//  https://github.com/edmBernard/bg-generation-penrose
+//
+//  Created by Erwan BERNARD on 11/09/2021.
+//
+//  Copyright (c) 2021 Erwan BERNARD. All rights reserved.
+//  Distributed under the Apache License, Version 2.0. (See accompanying
+//  file LICENSE or copy at http://www.apache.org/licenses/LICENSE-2.0)
+//
+
+// Checks run by ctest, the name of the test to run is the first argument.
+
+#include <cache.hpp>
+#include <exact.hpp>
+#include <packed.hpp>
+#include <penrose.hpp>
+#include <penrose_c.h>
+#include <png.hpp>
+#include <wallpaper.hpp>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace penrose;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                              \
+  do {                                                                                \
+    if (!(condition)) {                                                               \
+      fmt::print(stderr, "{}:{}: check failed: {}\n", __FILE__, __LINE__, #condition); \
+      ++failures;                                                                     \
+    }                                                                                 \
+  } while (false)
+
+uint32_t readUint32(const uint8_t *data) {
+  return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+// The PNG encoder output is decoded with zlib, every chunk CRC and the pixels must match
+void testPng() {
+  const size_t width = 301;
+  const size_t height = 203;
+  // flat areas, gradients and noise, so the encoder produces runs, matches and literals
+  std::vector<uint8_t> rgb(width * height * 3);
+  uint32_t noise = 12345;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      uint8_t *pixel = rgb.data() + (y * width + x) * 3;
+      noise = noise * 1664525u + 1013904223u;
+      if (y < height / 3) {
+        pixel[0] = 6, pixel[1] = 12, pixel[2] = 34;
+      } else if (y < 2 * height / 3) {
+        pixel[0] = uint8_t(x), pixel[1] = uint8_t(y), pixel[2] = uint8_t(x + y);
+      } else {
+        pixel[0] = uint8_t(noise >> 24), pixel[1] = uint8_t(noise >> 16), pixel[2] = uint8_t(noise >> 8);
+      }
+    }
+  }
+
+  const std::vector<uint8_t> file = png::encode(width, height, rgb);
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  CHECK(file.size() > 8 && std::equal(signature, signature + 8, file.begin()));
+
+  std::vector<std::string> types;
+  std::vector<uint8_t> header;
+  std::vector<uint8_t> idat;
+  for (size_t pos = 8; pos + 12 <= file.size();) {
+    const uint32_t length = readUint32(file.data() + pos);
+    CHECK(pos + 12 + length <= file.size());
+    if (pos + 12 + length > file.size()) {
+      return;
+    }
+    const std::string type(reinterpret_cast<const char *>(file.data() + pos + 4), 4);
+    const uint8_t *content = file.data() + pos + 8;
+    const uLong crc = ::crc32(::crc32(0L, Z_NULL, 0), file.data() + pos + 4, length + 4);
+    CHECK(readUint32(content + length) == crc);
+    types.push_back(type);
+    if (type == "IHDR") {
+      header.assign(content, content + length);
+    } else if (type == "IDAT") {
+      idat.insert(idat.end(), content, content + length);
+    }
+    pos += 12 + length;
+  }
+  CHECK((types == std::vector<std::string>{"IHDR", "IDAT", "IEND"}));
+  CHECK(header.size() == 13 && readUint32(header.data()) == width && readUint32(header.data() + 4) == height);
+  CHECK(header.size() == 13 && header[8] == 8 && header[9] == 2 && header[12] == 0);
+
+  std::vector<uint8_t> filtered(height * (1 + 3 * width));
+  uLongf size = static_cast<uLongf>(filtered.size());
+  CHECK(uncompress(filtered.data(), &size, idat.data(), static_cast<uLong>(idat.size())) == Z_OK);
+  CHECK(size == filtered.size());
+
+  // undo the row filters, the encoder may use any of the 5 PNG filters
+  std::vector<uint8_t> decoded(rgb.size());
+  for (size_t y = 0; y < height; ++y) {
+    const uint8_t filter = filtered[y * (1 + 3 * width)];
+    const uint8_t *in = filtered.data() + y * (1 + 3 * width) + 1;
+    uint8_t *row = decoded.data() + y * 3 * width;
+    const uint8_t *previous = y > 0 ? row - 3 * width : nullptr;
+    CHECK(filter <= 4);
+    for (size_t x = 0; x < 3 * width; ++x) {
+      const int a = x >= 3 ? row[x - 3] : 0;
+      const int b = previous ? previous[x] : 0;
+      const int c = previous && x >= 3 ? previous[x - 3] : 0;
+      int predictor = 0;
+      if (filter == 1) {
+        predictor = a;
+      } else if (filter == 2) {
+        predictor = b;
+      } else if (filter == 3) {
+        predictor = (a + b) / 2;
+      } else if (filter == 4) {
+        const int p = a + b - c;
+        const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+      }
+      row[x] = static_cast<uint8_t>(in[x] + predictor);
+    }
+  }
+  CHECK(decoded == rgb);
+}
+
+// A stored tiling is loaded unchanged, and rejected once its file is corrupted
+void testCache() {
+  const std::filesystem::path directory = std::filesystem::temp_directory_path() / fmt::format("penrose-tests-{}", std::random_device{}());
+  const cache::Key key = {false, false, false, false, 5, 3, 640, 480};
+  const std::vector<PenroseTriangle> patch = initialPatch(false, {640, 480});
+  const std::vector<PenroseQuadrilateral> coarse = deflateAndMerge(patch, 3);
+  const std::vector<PenroseQuadrilateral> tiles = deflateAndMerge(patch, 5);
+  const std::vector<uint32_t> parent = findParents(tiles, coarse);
+  CHECK(!tiles.empty() && !coarse.empty());
+
+  CHECK(!cache::load(directory, key));
+  CHECK(cache::store<PenroseQuadrilateral>(directory, key, tiles, coarse, parent));
+  {
+    const std::optional<cache::Tiling<PenroseQuadrilateral>> loaded = cache::load(directory, key);
+    CHECK(loaded.has_value());
+    if (loaded) {
+      CHECK(std::equal(loaded->tiles.begin(), loaded->tiles.end(), tiles.begin(), tiles.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.vertices == rhs.vertices && lhs.color == rhs.color && lhs.flag == rhs.flag;
+      }));
+      CHECK(loaded->coarse.size() == coarse.size());
+      CHECK(std::equal(loaded->parent.begin(), loaded->parent.end(), parent.begin(), parent.end()));
+    }
+  }
+  // another key never maps this file, nor packed records
+  CHECK(!cache::load(directory, {false, false, false, false, 5, 2, 640, 480}));
+  CHECK(!cache::load<PackedTriangle>(directory, key));
+
+  // packed tiles come back with the frame and level their vertices are rebuilt from
+  const cache::Key packedKey = {false, false, true, false, 5, 0, 640, 480};
+  const PackedTiling packed = deflateAndMerge(pack(patch), 5);
+  const cache::PackedLevels levels = {packed.frame, packed.level, packed.level};
+  CHECK(cache::store<PackedTriangle>(directory, packedKey, packed.triangles, {}, {}, levels));
+  {
+    const std::optional<cache::Tiling<PackedTriangle>> loaded = cache::load<PackedTriangle>(directory, packedKey);
+    CHECK(loaded.has_value());
+    if (loaded) {
+      CHECK(loaded->levels.tiles == packed.level && loaded->levels.frame.rotation == packed.frame.rotation && loaded->levels.frame.scale == packed.frame.scale);
+      const std::vector<PenroseQuadrilateral> expected = toQuadrilaterals(packed);
+      const PackedLevel table(loaded->levels.frame, loaded->levels.tiles);
+      CHECK(std::ranges::equal(quadrilateralView(loaded->tiles, table), expected, [](const auto &lhs, const auto &rhs) {
+        return lhs.vertices == rhs.vertices && lhs.color == rhs.color && lhs.flag == rhs.flag;
+      }));
+    }
+  }
+
+  // one flipped bit in the tiles, then in the header
+  const std::filesystem::path path = directory / cache::filename(key);
+  const auto corrupt = [&](std::streamoff offset) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(offset);
+    char byte = 0;
+    file.read(&byte, 1);
+    byte ^= 0x10;
+    file.seekp(offset);
+    file.write(&byte, 1);
+  };
+  const std::streamoff tileByte = static_cast<std::streamoff>(std::filesystem::file_size(path) / 2);
+  corrupt(tileByte);
+  CHECK(!cache::load(directory, key));
+  corrupt(tileByte);
+  CHECK(cache::load(directory, key).has_value());
+  corrupt(offsetof(cache::Header, level));
+  CHECK(!cache::load(directory, key));
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+}
+
+// The exact backend gives the same tiles than the float one, up to the float rounding
+void testExact() {
+  const Canvas canvas = {800, 600};
+  const Rectangle view = viewport(canvas);
+  const Frame frame = {patchCenter(canvas), patchRadius(canvas), pi / 10};
+  std::vector<ExactTriangle> exactPatch;
+  const ExactPoint exactCenter = {{0, 0, 0, 0}};
+  for (int i = 0, sign = -1; i < 10; ++i, sign *= -1) {
+    exactPatch.emplace_back(TriangleKind::kDart, unitRoot((2 * i - sign - 1) / 2), exactCenter, unitRoot((2 * i + sign - 1) / 2));
+  }
+
+  for (int level : {3, 5, 7}) {
+    const std::vector<PenroseQuadrilateral> tiles = deflateAndMerge(initialPatch(false, canvas), level, 1, view);
+    const std::vector<PenroseQuadrilateral> exactTiles = toFloat(deflateAndMerge(exactPatch, level, frame, view), frame);
+    // tiles crossing the border may be culled differently, only the visible ones are compared
+    auto visibleCenters = [&](const std::vector<PenroseQuadrilateral> &quads) {
+      std::map<std::pair<long, long>, TriangleKind> centers;
+      for (const PenroseQuadrilateral &quad : quads) {
+        if (contains(view, boundingBox(quad))) {
+          const Point center = quad.center();
+          centers.emplace(std::make_pair(std::lround(center.x * 4), std::lround(center.y * 4)), quad.color);
+        }
+      }
+      return centers;
+    };
+    const auto centers = visibleCenters(tiles);
+    const auto exactCenters = visibleCenters(exactTiles);
+    CHECK(!centers.empty());
+    CHECK(centers.size() == exactCenters.size());
+    size_t missing = 0;
+    for (const auto &[cell, kind] : exactCenters) {
+      // a center rounded near a cell border may fall in the next cell
+      bool found = false;
+      for (long dx = -1; dx <= 1 && !found; ++dx) {
+        for (long dy = -1; dy <= 1 && !found; ++dy) {
+          const auto it = centers.find({cell.first + dx, cell.second + dy});
+          found = it != centers.end() && it->second == kind;
+        }
+      }
+      missing += !found;
+    }
+    CHECK(missing == 0);
+  }
+}
+
+int writeAll(void *, const char *, size_t) {
+  return 1;
+}
+
+int writeNothing(void *, const char *, size_t) {
+  return 0;
+}
+
+// Status and last error of the C interface
+void testCApi() {
+  penrose_options options;
+  penrose_default_options(&options);
+  options.level = 3;
+  penrose_style style;
+  penrose_default_style(&style);
+
+  size_t count = 0;
+  CHECK(penrose_generate(nullptr, nullptr, 0, &count) == PENROSE_INVALID_ARGUMENT);
+  CHECK(std::string_view(penrose_last_error()) != "");
+
+  penrose_options invalid = options;
+  invalid.level = -1;
+  CHECK(penrose_max_tiles(&invalid) == 0);
+  CHECK(penrose_generate(&invalid, nullptr, 0, &count) == PENROSE_INVALID_ARGUMENT);
+  invalid = options;
+  invalid.width = 0;
+  CHECK(penrose_generate(&invalid, nullptr, 0, &count) == PENROSE_INVALID_ARGUMENT);
+
+  // the tile count is returned when the tiles do not fit
+  std::vector<penrose_tile> tiles(2);
+  CHECK(penrose_generate(&options, tiles.data(), tiles.size(), &count) == PENROSE_BUFFER_TOO_SMALL);
+  CHECK(count > tiles.size() && count <= penrose_max_tiles(&options));
+  tiles.resize(count);
+  CHECK(penrose_generate(&options, tiles.data(), tiles.size(), &count) == PENROSE_OK);
+  CHECK(count == tiles.size());
+
+  penrose_tile badTile = tiles[0];
+  badTile.kind = 7;
+  CHECK(penrose_write_svg(&options, &badTile, 1, &style, writeAll, nullptr) == PENROSE_INVALID_ARGUMENT);
+  CHECK(penrose_write_svg(&options, tiles.data(), tiles.size(), &style, nullptr, nullptr) == PENROSE_INVALID_ARGUMENT);
+  CHECK(penrose_write_svg(&options, tiles.data(), tiles.size(), &style, writeNothing, nullptr) == PENROSE_WRITE_ERROR);
+
+  size_t size = 0;
+  char small[16];
+  CHECK(penrose_write_svg_buffer(&options, tiles.data(), tiles.size(), &style, small, sizeof(small), &size) == PENROSE_BUFFER_TOO_SMALL);
+  CHECK(size > sizeof(small));
+  std::vector<char> buffer(size);
+  CHECK(penrose_write_svg_buffer(&options, tiles.data(), tiles.size(), &style, buffer.data(), buffer.size(), &size) == PENROSE_OK);
+  CHECK(size == buffer.size() && std::string_view(buffer.data(), 4) == "<svg");
+
+  penrose_packed_tile packed[1] = {};
+  packed[0].orientation = 200;
+  CHECK(penrose_write_packed_svg(&options, packed, 1, &style, writeAll, nullptr) == PENROSE_INVALID_ARGUMENT);
+  CHECK(penrose_tile_shapes(&options, nullptr) == PENROSE_INVALID_ARGUMENT);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const std::map<std::string, std::function<void()>> tests = {
+      {"png", testPng},
+      {"cache", testCache},
+      {"exact", testExact},
+      {"c-api", testCApi},
+  };
+  spdlog::set_level(spdlog::level::err);
+  bool found = false;
+  for (const auto &[name, test] : tests) {
+    if (argc < 2 || name == argv[1]) {
+      const int previous = failures;
+      test();
+      fmt::print("{} : {}\n", name, failures == previous ? "passed" : "failed");
+      found = true;
+    }
+  }
+  if (!found) {
+    fmt::print(stderr, "Unknown test : {}\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}